@@ -0,0 +1,65 @@
+/*
+ * Cycle-count benchmarking support.
+ *
+ * (C) 2021 Simon Frankau
+ */
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "bench.h"
+#include "print.h"
+
+static volatile unsigned int bench_overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+    bench_overflows++;
+}
+
+void bench_start(void)
+{
+    // Normal mode, no prescaling, so each tick is one cycle.
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    bench_overflows = 0;
+    TIFR1 = 1 << TOV1;
+    TIMSK1 = 1 << TOIE1;
+    TCCR1B = 1 << CS10;
+}
+
+unsigned long bench_now(void)
+{
+    char sreg = SREG;
+    cli();
+    unsigned int low = TCNT1;
+    unsigned int high = bench_overflows;
+    // An overflow may have happened since interrupts were disabled.
+    if ((TIFR1 & (1 << TOV1)) && low < 0x8000) {
+        high++;
+    }
+    SREG = sreg;
+    return ((unsigned long)high << 16) | low;
+}
+
+unsigned long bench_stop(void)
+{
+    unsigned long cycles = bench_now();
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    return cycles;
+}
+
+void bench_print_P(const char *label, unsigned long cycles)
+{
+    print_P(label);
+    print(": 0x");
+    phex16(cycles >> 16);
+    phex16(cycles);
+    print(" cycles\n");
+    // Debug output drops what doesn't fit, so send each line before
+    // the next.
+    usb_debug_flush_output();
+}
@@ -0,0 +1,20 @@
+#ifndef bench_h__
+#define bench_h__
+
+#include <avr/pgmspace.h>
+
+// Cycle counting for benchmarks. Timer1 runs at the full CPU clock,
+// with an overflow interrupt extending it to 32 bits.
+void bench_start(void);
+unsigned long bench_stop(void);
+// The count so far, leaving it running. It wraps after 2^32 cycles,
+// so differences between counts are still right.
+unsigned long bench_now(void);
+
+// Print a labelled cycle count over USB debug. As with print(), the
+// label is automatically placed into flash memory.
+#define bench_print(s, cycles) bench_print_P(PSTR(s), cycles)
+
+void bench_print_P(const char *label, unsigned long cycles);
+
+#endif
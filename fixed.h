@@ -0,0 +1,97 @@
+#ifndef fixed_h__
+#define fixed_h__
+
+//
+// Q8.8 fixed point: 8 bits of integer and 8 bits of fraction. Mostly
+// used as a position in one of the tables from gen/waves.h, so
+// effects can move by fractions of an entry, interpolating between
+// entries rather than needing bigger tables or floating point.
+//
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+typedef int16_t q8_8;
+
+// Only for constants, as it'd pull in floating point otherwise.
+#define Q8_8(x) ((q8_8)((x) * 256))
+
+// Unsigned Q8.8, for phases: positions in a periodic table that an
+// effect moves along every frame. Signed ones would overflow after 128
+// entries, which is undefined, but these wrap round after 256, and
+// as table lengths are powers of two up to 256, that doesn't show.
+typedef uint16_t uq8_8;
+
+#define UQ8_8(x) ((uq8_8)((x) * 256))
+
+static inline int8_t fixed_int(q8_8 a)
+{
+    return a >> 8;
+}
+
+static inline uint8_t fixed_frac(q8_8 a)
+{
+    return a & 0xff;
+}
+
+static inline int fixed_round(q8_8 a)
+{
+    return (a + 0x80) >> 8;
+}
+
+static inline q8_8 fixed_mul(q8_8 a, q8_8 b)
+{
+    return ((int32_t)a * b) >> 8;
+}
+
+// Interpolate "frac" / 256 of the way from a to b, rounding to nearest.
+// Done as an unsigned 8x8 multiply either way so it can't overflow.
+static inline int fixed_lerp(int a, int b, uint8_t frac)
+{
+    if (b >= a) {
+        return a + (((uint16_t)(b - a) * frac + 0x80) >> 8);
+    } else {
+        return a - (((uint16_t)(a - b) * frac + 0x80) >> 8);
+    }
+}
+
+// Value of a periodic table of bytes (e.g. cos_table_64_4) at "pos".
+// The table's length must be a power of two, with "mask" one less.
+static inline uint8_t fixed_wave_u8_P(uint8_t const *table, uint8_t mask,
+                                      uq8_8 pos)
+{
+    uint8_t i = (pos >> 8) & mask;
+    uint8_t a = pgm_read_byte(&table[i]);
+    uint8_t b = pgm_read_byte(&table[(i + 1) & mask]);
+    return fixed_lerp(a, b, pos & 0xff);
+}
+
+// As fixed_wave_u8_P, for signed tables (e.g. sin_table_256_127).
+static inline int8_t fixed_wave_i8_P(int8_t const *table, uint8_t mask,
+                                     uq8_8 pos)
+{
+    uint8_t i = (pos >> 8) & mask;
+    int8_t a = pgm_read_byte(&table[i]);
+    int8_t b = pgm_read_byte(&table[(i + 1) & mask]);
+    return fixed_lerp(a, b, pos & 0xff);
+}
+
+// Value of an easing table of bytes with "period" + 1 entries (e.g.
+// ease_in_out_table_64_255) at "t", from 0 to 1.0. Clamps outside
+// that.
+static inline uint8_t fixed_ease_u8_P(uint8_t const *table, uint8_t period,
+                                      q8_8 t)
+{
+    if (t <= 0) {
+        return pgm_read_byte(&table[0]);
+    }
+    if (t >= Q8_8(1)) {
+        return pgm_read_byte(&table[period]);
+    }
+    uint16_t pos = (uint16_t)t * period;
+    uint8_t i = pos >> 8;
+    return fixed_lerp(pgm_read_byte(&table[i]), pgm_read_byte(&table[i + 1]),
+                      pos & 0xff);
+}
+
+#endif // fixed_h__
@@ -0,0 +1,29 @@
+#ifndef log_h__
+#define log_h__
+
+#include <stdint.h>
+
+#include "usb_debug_only.h"
+
+// Tokenized logging over USB debug. Rather than formatting text on
+// the device, LOG(NAME, "format", args...) sends a record of LOG_MARK,
+// NAME's token, and the arguments as raw little-endian bytes. The
+// format never reaches flash: tools/src/bin/log2teensy.rs collects
+// every LOG from the sources at build time into gen/logtokens.h, with
+// a function per token taking arguments of the types its format
+// needs, and a table for tools/src/bin/teensylog.rs to turn records
+// back into text.
+//
+// Formats use printf conversions of integers, characters and floats:
+// %d, %u, %x, %c and %f, with "l" for longs and "hh" for bytes.
+//
+// Records share the debug channel with ordinary text, which never
+// contains LOG_MARK. Each is buffered whole or dropped whole, so the
+// stream never gets out of step.
+#define LOG_MARK 0xff
+
+#define LOG(name, fmt, ...) log_##name(__VA_ARGS__)
+
+#include "gen/logtokens.h"
+
+#endif
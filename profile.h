@@ -0,0 +1,48 @@
+#ifndef profile_h__
+#define profile_h__
+
+#include <stdint.h>
+
+// Sampling profiler. Timer3 interrupts every PROFILE_PERIOD cycles,
+// and the interrupted address is counted in a histogram of the code,
+// PROFILE_BUCKETS buckets of a power of two bytes each, as few as
+// cover it. The host reads the histogram as a feature report of the
+// debug interface (see tools/src/bin/teensyprof.rs).
+//
+// Counts wrap, rather than saturating, so the host takes the
+// differences between reports, often enough that none wraps twice.
+//
+// Samples that were held up, because another interrupt was being
+// handled or interrupts were off, go in "blocked" rather than against
+// the address returned to: that's mostly time in the USB interrupts.
+
+// Roughly 1kHz at 8MHz. Prime, so it doesn't fall into step with
+// anything periodic.
+#ifndef PROFILE_PERIOD
+#define PROFILE_PERIOD 7919
+#endif
+
+// At most 255. Each takes two bytes of RAM.
+#ifndef PROFILE_BUCKETS
+#define PROFILE_BUCKETS 128
+#endif
+
+// Sent as is: AVR is little-endian, and there's no padding.
+struct profile {
+    // Byte address of the start of the code, and log2 of the bytes per
+    // bucket.
+    uint16_t lo;
+    uint8_t shift;
+    uint8_t buckets;
+    uint16_t blocked;
+    // Samples outside the code, as in the bootloader.
+    uint16_t outside;
+    uint16_t counts[PROFILE_BUCKETS];
+};
+
+extern struct profile profile;
+
+// Takes over Timer3, and starts sampling.
+void profile_start(void);
+
+#endif
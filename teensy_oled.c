@@ -8,18 +8,30 @@
  * (C) 2021 Simon Frankau
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
 
-#include "cos_table.h"
+#include "bench.h"
+#include "fixed.h"
+#include "gen/atlas.h"
+#include "gen/bounce.h"
 #include "gen/charset.h"
+#include "gen/colmaps.h"
+#include "gen/extended.h"
 #include "gen/head.h"
 #include "gen/heels.h"
+#include "gen/messages.h"
+#include "gen/shades.h"
+#include "gen/waves.h"
+#include "log.h"
 #include "usb_debug_only.h"
 #include "print.h"
+#include "profile.h"
 
 // Support the case where the OLED is configured for the alternate I2C
 // address.
@@ -38,6 +50,11 @@ static const char OLED_SUB_ADDR = 0;
     #define VFLIP 0
 #endif
 
+// For drawing routines that a given build might not call. They're
+// always built, so they're there to use, but the compiler doesn't warn
+// about them, and leaves out any that aren't called.
+#define MAYBE_UNUSED static __attribute__((unused))
+
 ////////////////////////////////////////////////////////////////////////
 // CPU prescaler
 //
@@ -85,6 +102,70 @@ static inline void led_off(void)
 static const char SCL = 0;
 static const char SDA = 1;
 
+#ifdef TELEMETRY
+// Bus traffic since the last telemetry record (see Telemetry, below).
+static unsigned int i2c_bytes;
+static unsigned int i2c_transactions;
+static unsigned int i2c_nacks;
+#endif // TELEMETRY
+
+#ifdef MIRROR
+// With MIRROR, every transaction on the bus is copied over USB debug,
+// so tools/src/bin/teensymirror.rs can rebuild what's on the display
+// from the SSD1306 commands and data. The panel can't be read back,
+// and most modes keep no framebuffer, so snapshots aren't possible;
+// this also catches what the host link's bridge sends.
+//
+// Records are MIRROR_MARK, a header (the top bit set for the first of
+// a transaction, and the length), a sequence number, and up to
+// MIRROR_CHUNK bytes, the first of a transaction being its address.
+// The cost is bounded: a little per byte, against some 200 cycles to
+// send it, and nothing ever waits. Records that don't fit in the debug
+// buffer are dropped, and the gap in sequence numbers tells the host.
+// BENCHMARK measures it.
+#define MIRROR_MARK 0xfe
+// So a record fills a debug packet.
+#define MIRROR_CHUNK 29
+
+// Cleared to measure what mirroring costs.
+static char mirror_on = 1;
+static char mirror_buf[3 + MIRROR_CHUNK];
+static char mirror_len;
+static char mirror_first;
+static unsigned char mirror_seq;
+
+// Sends what's been gathered. The sequence number counts records
+// dropped as well as sent.
+static void mirror_flush(void)
+{
+    if (mirror_len == 0) {
+        return;
+    }
+    mirror_buf[0] = MIRROR_MARK;
+    mirror_buf[1] = (mirror_first ? 0x80 : 0) | mirror_len;
+    mirror_buf[2] = mirror_seq++;
+    usb_debug_write((const uint8_t *)mirror_buf, 3 + mirror_len);
+    mirror_len = 0;
+    mirror_first = 0;
+}
+
+static inline void mirror_start(void)
+{
+    mirror_flush();
+    mirror_first = 1;
+}
+
+static inline void mirror_byte(char c)
+{
+    if (mirror_on) {
+        mirror_buf[3 + mirror_len++] = c;
+        if (mirror_len == MIRROR_CHUNK) {
+            mirror_flush();
+        }
+    }
+}
+#endif // MIRROR
+
 static void i2c_init(void)
 {
     // In I2C the lines float high and are actively pulled low, so we
@@ -149,6 +230,9 @@ static void i2c_send_bit(int i)
 
 static char i2c_send_byte(char c)
 {
+#ifdef MIRROR
+    mirror_byte(c);
+#endif // MIRROR
     // Send a byte of data.
     for (char mask = 0x80; mask != 0; mask >>= 1) {
         i2c_send_bit(c & mask);
@@ -160,6 +244,10 @@ static char i2c_send_byte(char c)
     // And ack the ack/nack with a normal clock cycle.
     i2c_clock();
 
+#ifdef TELEMETRY
+    i2c_bytes++;
+    i2c_nacks += !acked;
+#endif // TELEMETRY
     return acked;
 }
 
@@ -171,6 +259,12 @@ static inline char i2c_start(char addr)
     _delay_us(1);
     i2c_pulldown(SCL);
 
+#ifdef TELEMETRY
+    i2c_transactions++;
+#endif // TELEMETRY
+#ifdef MIRROR
+    mirror_start();
+#endif // MIRROR
     return i2c_send_byte(addr);
 }
 
@@ -184,6 +278,9 @@ static inline void i2c_stop(void)
     i2c_release(SDA);
     // Idle time
     _delay_us(2);
+#ifdef MIRROR
+    mirror_flush();
+#endif // MIRROR
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -195,11 +292,15 @@ static inline void i2c_stop(void)
 #define OLED_CMD                    0x00
 #define OLED_DATA                   0x40
 
+#define OLED_WIDTH                  128
+#define OLED_PAGES                  4
+
 #define OLED_SET_LOWER_COLUMN       0x00
 #define OLED_SET_UPPER_COLUMN       0x10
 #define OLED_SET_ADDR_MODE          0x20
 #define OLED_SET_COL_ADDR           0x21
 #define OLED_SET_PAGE_ADDR          0x22
+#define OLED_SCROLL_LEFT_ONE        0x2d
 #define OLED_SET_DISPLAY_START_LINE 0x40
 #define OLED_SET_CONTRAST           0x81
 #define OLED_SET_CHARGE_PUMP        0x8d
@@ -294,7 +395,7 @@ static void oled_clear(void)
     // And write the data
     i2c_start(OLED_ADDR);
     i2c_send_byte(OLED_DATA);
-    for (int i = 0; i < 128 * 4; i++) {
+    for (int i = 0; i < OLED_WIDTH * OLED_PAGES; i++) {
         i2c_send_byte(0x00);
     }
     i2c_stop();
@@ -312,238 +413,3409 @@ static void oled_set_page_mode(char page, char x) {
     i2c_stop();
 }
 
-// Blit an image to the screen. Y coordinates are pages (multiples of 8 pixels)
-static void oled_blit(char x, char y, char w, char h, char const *image)
+static void oled_contrast(unsigned char c)
 {
-    // I'd much rather use horizontal addressing mode, but when we set
-    // the start and end column it acutally starts loading memory at start
-    // column & 0xf0. It wraps around to the right place, though. The
-    // bugs of cheap hardware still surprise me.
-    //
-    // As it is, we use page mode, and write each page separately.
     i2c_start(OLED_ADDR);
     i2c_send_byte(OLED_CMD);
-    i2c_send_byte(OLED_SET_ADDR_MODE); i2c_send_byte(0x02); // Page mode
+    i2c_send_byte(OLED_SET_CONTRAST);
+    i2c_send_byte(c);
+    i2c_stop();
+}
+
+#ifdef HW_SCROLL
+// Scrolls columns "x" to "x" + "w" - 1 of pages "page" to "page" + "h"
+// - 1 left by one column. See the Charts section for which displays
+// can do this.
+static void oled_scroll_left(char page, char h, char x, char w)
+{
+    i2c_start(OLED_ADDR);
+    i2c_send_byte(OLED_CMD);
+    i2c_send_byte(OLED_SCROLL_LEFT_ONE);
+    i2c_send_byte(0x00);
+    i2c_send_byte(page);
+    i2c_send_byte(0x01);
+    i2c_send_byte(page + h - 1);
+    i2c_send_byte(0x00);
+    i2c_send_byte(x);
+    i2c_send_byte(x + w - 1);
     i2c_stop();
+}
+#endif // HW_SCROLL
 
-    char const *image_ptr = image;
-    for (int page = y; page < y + h; page++) {
-        oled_set_page_mode(page, x);
+////////////////////////////////////////////////////////////////////////
+// Clipping
+//
+// All drawing routines clip against a rectangle, initially the whole
+// screen. Columns outside it are never sent, so something that's
+// mostly off-screen is cheap to draw. Positions are ints so that
+// things can hang off the left or top edge.
+//
 
-        i2c_start(OLED_ADDR);
-        i2c_send_byte(OLED_DATA);
-        for (int i = 0; i < w; i++) {
-            i2c_send_byte(*image_ptr++);
-        }
-        i2c_stop();
+// Clip rectangle. Left and top are inclusive, right and bottom
+// exclusive. Top and bottom are in pages.
+static char clip_left = 0;
+static char clip_top = 0;
+static char clip_right = OLED_WIDTH;
+static char clip_bottom = OLED_PAGES;
+
+// For the data transfer in progress, the number of columns to drop
+// before sending anything, and then the number of columns to send.
+static int clip_skip;
+static int clip_count;
+
+// Set the clip rectangle, limited to the screen.
+MAYBE_UNUSED void oled_set_clip(int left, int top, int right, int bottom)
+{
+    clip_left = left < 0 ? 0 : left;
+    clip_top = top < 0 ? 0 : top;
+    clip_right = right > OLED_WIDTH ? OLED_WIDTH : right;
+    clip_bottom = bottom > OLED_PAGES ? OLED_PAGES : bottom;
+}
+
+MAYBE_UNUSED void oled_reset_clip(void)
+{
+    oled_set_clip(0, 0, OLED_WIDTH, OLED_PAGES);
+}
+
+// Clip a run of "w" columns at "x" horizontally, setting clip_skip
+// and clip_count. Returns 0 if none of it is visible.
+static char clip_columns(int x, int w)
+{
+    int left = x < clip_left ? clip_left : x;
+    int right = x + w > clip_right ? clip_right : x + w;
+    if (left >= right) {
+        return 0;
     }
+    clip_skip = left - x;
+    clip_count = right - left;
+    return 1;
 }
 
-// Displays a string using the ZX Spectrum character set.
-static void oled_write(char x, char y, char const *str)
+// Clip a run of "w" columns at "x" on page "y". If any of it is
+// visible, sets clip_skip and clip_count, and starts the data
+// transfer at the first visible column. Otherwise returns 0 without
+// sending anything.
+static char oled_start_clipped(int x, int y, int w)
 {
-    oled_set_page_mode(y, x);
+    if (y < clip_top || y >= clip_bottom || !clip_columns(x, w)) {
+        return 0;
+    }
+
+    oled_set_page_mode(y, x + clip_skip);
 
     i2c_start(OLED_ADDR);
     i2c_send_byte(OLED_DATA);
-    for (; *str != '\0'; str++) {
-        char c = *str;
-        char idx = (32 <= c && c < 128) ? c - 32 : 3;
-        char const *ptr = charset + idx * 8;
-        for (int i = 8; i > 0; i--) {
-            i2c_send_byte(*ptr++);
-        }
-    }
+    return 1;
+}
+
+// For column transfers, the number of pages above the clip rectangle,
+// and the number of pages sent for each column.
+static char clip_page_skip;
+static char clip_pages;
+
+// Set vertical addressing mode, writing a column at a time down pages
+// "page" to "page + h - 1", starting at column x.
+static void oled_set_vertical_mode(char page, char h, char x) {
+    i2c_start(OLED_ADDR);
+    i2c_send_byte(OLED_CMD);
+    i2c_send_byte(OLED_SET_ADDR_MODE); i2c_send_byte(0x01); // Vertical mode
+    // Leaving the end column at the far right means page mode still
+    // works afterwards.
+    i2c_send_byte(OLED_SET_COL_ADDR); i2c_send_byte(x); i2c_send_byte(0x7f);
+    i2c_send_byte(OLED_SET_PAGE_ADDR);
+    i2c_send_byte(page); i2c_send_byte(page + h - 1);
+    // See oled_blit for the start column quirk. Setting the column
+    // pointer directly as well keeps us safe.
+    i2c_send_byte(OLED_SET_UPPER_COLUMN | (x >> 4));
+    i2c_send_byte(OLED_SET_LOWER_COLUMN | (x & 0x0f));
     i2c_stop();
 }
 
-// Displays a string with a scrolling marquee effect.
-// "speed" can be up to 8. "offset" is updated as it scrolls.
-static void oled_marquee(char x, char y, char w,
-                         char const *str, int *offset, int speed)
+// Like oled_start_clipped, but for a block "h" pages high, which is
+// then sent a column at a time, top to bottom. Also sets
+// clip_page_skip and clip_pages.
+static char oled_start_clipped_columns(int x, int y, int w, int h)
 {
-    oled_set_page_mode(y, x);
+    int top = y < clip_top ? clip_top : y;
+    int bottom = y + h > clip_bottom ? clip_bottom : y + h;
+    if (top >= bottom || !clip_columns(x, w)) {
+        return 0;
+    }
+    clip_page_skip = top - y;
+    clip_pages = bottom - top;
 
-    char sub_offset = *offset & 0x07;
+    oled_set_vertical_mode(top, clip_pages, x + clip_skip);
 
     i2c_start(OLED_ADDR);
     i2c_send_byte(OLED_DATA);
+    return 1;
+}
 
-    char const *str_ptr = str + (*offset >> 3);
-    while (w != 0) {
-        char c = *str_ptr;
-        char idx = (32 <= c && c < 128) ? c - 32 : 3;
-        char const *ptr = charset + idx * 8 + sub_offset;
-        for (int i = 8 - sub_offset; i > 0; i--) {
-            i2c_send_byte(*ptr++);
-            if (--w == 0) {
-                break;
-            }
+////////////////////////////////////////////////////////////////////////
+// Text
+//
+// Strings are UTF-8. ASCII comes from the ZX Spectrum character set.
+// Anything else is looked up in the sparse extended glyph set in flash
+// (built from fonts/extended.png), which is sorted by code point so we
+// can binary search it. Characters in neither are shown as glyph 3.
+//
+
+// Code point used for malformed UTF-8, and characters beyond 16 bits.
+#define UTF8_INVALID 0xfffd
+
+// Decodes the next character of a UTF-8 string, advancing past it.
+static unsigned int utf8_next(char const **str)
+{
+    unsigned char const *s = (unsigned char const *)*str;
+    unsigned int c = *s++;
+    if (c < 0x80) {
+        // ASCII.
+    } else if (c >= 0xc0 && c < 0xe0 && (s[0] & 0xc0) == 0x80) {
+        c = ((c & 0x1f) << 6) | (s[0] & 0x3f);
+        s += 1;
+    } else if (c >= 0xe0 && c < 0xf0 &&
+               (s[0] & 0xc0) == 0x80 && (s[1] & 0xc0) == 0x80) {
+        c = ((c & 0x0f) << 12) | ((s[0] & 0x3f) << 6) | (s[1] & 0x3f);
+        s += 2;
+    } else {
+        // Skip the rest of whatever this was.
+        while ((*s & 0xc0) == 0x80) {
+            s++;
+        }
+        c = UTF8_INVALID;
+    }
+    *str = (char const *)s;
+    return c;
+}
+
+// Skips "n" characters of a UTF-8 string.
+static char const *utf8_skip(char const *str, int n)
+{
+    for (; n > 0; n--) {
+        utf8_next(&str);
+    }
+    return str;
+}
+
+// Number of characters in a UTF-8 string, decoded as utf8_next does,
+// so malformed bytes count as the UTF8_INVALID they're drawn as.
+static int utf8_len(char const *str)
+{
+    int n = 0;
+    while (*str != '\0') {
+        utf8_next(&str);
+        n++;
+    }
+    return n;
+}
+
+// Finds a non-ASCII character in the extended glyph set, returning
+// its index, or -1 if it's not there.
+static int oled_extended_index(unsigned int c)
+{
+    int lo = 0;
+    int hi = extended_count;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        unsigned int code = pgm_read_word(&extended_codes[mid]);
+        if (code == c) {
+            return mid;
         }
-        sub_offset = 0;
-        if (*++str_ptr == '\0') {
-            str_ptr = str;
+        if (code < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    i2c_stop();
+    return -1;
+}
 
-    // Move the pointer along, returning to the start once we hit the end.
-    *offset += speed;
-    if (str[*offset >> 3] == '\0') {
-        *offset &= 7;
+// Looks up a non-ASCII character in the extended glyph set, copying
+// its columns out of flash into "buf".
+static char const *oled_extended_glyph(unsigned int c, char *buf)
+{
+    int i = oled_extended_index(c);
+    if (i < 0) {
+        return charset + 3 * 8;
     }
+    memcpy_P(buf, extended_glyphs + i * 8, 8);
+    return buf;
 }
 
-static void oled_bungee_marquee_aux(char const *str, int offset, int w)
+// Returns the 8 columns for the next character of a UTF-8 string, and
+// advances past it. "buf" holds the columns of extended characters.
+static inline char const *oled_next_glyph(char const **str, char *buf)
 {
-    // We increase the scaling factor before the midpoint, decrease it after.
-    int midpoint = (w >> 1);
-    int scale = 0;
+    unsigned char c = **str;
+    if (c < 0x80) {
+        (*str)++;
+        char idx = (32 <= c) ? c - 32 : 3;
+        return charset + idx * 8;
+    }
+    return oled_extended_glyph(utf8_next(str), buf);
+}
 
-    char const *str_ptr = str + (offset >> 3);
-    char sub_offset = offset & 0x07;
 
-    // Run over the characters in the message loop.
-    while (1) {
-        char c = *str_ptr;
-        char idx = (32 <= c && c < 128) ? c - 32 : 3;
-        char const *ptr = charset + idx * 8 + sub_offset;
-        // For each slice of the character displayed...
-        for (int i = 8 - sub_offset; i > 0; i--) {
-            // The factor of 8 empirically makes a nice effect on a 128 display.
-            for (char j = 0; j < 1 + (scale / 8); j++) {
-                i2c_send_byte(*ptr);
-                if (--w == 0) {
-                    return;
-                }
-            }
-            ptr++;
+////////////////////////////////////////////////////////////////////////
+// Column streams
+//
+// Effects are built as pipelines pulling one byte at a time: a source
+// (text, flash columns, a bitmap in RAM), any number of stages
+// (offset, horizontal scale, vertical shift, invert, mask), and a sink
+// which sends to the display or into memory.
+//
+// Sources and stages are a struct of state and a "next" function.
+// Stages that change the number of columns pull from their upstream,
+// which is passed in along with its next function. Stages that just
+// change each byte are plain functions. Everything is inline, so once
+// an effect's pipeline is put together the compiler is left with one
+// loop and no calls or intermediate buffers, same as a hand-written
+// one.
+//
 
-            // Scaling code. The check is because the count up and
-            // down is a bit uneven and can end up below 0 otherwise.
-            scale += (w > midpoint) ? 1 : -1;
-            if (scale < 0) {
-                scale = 0;
-            }
-        }
-        sub_offset = 0;
-        if (*++str_ptr == '\0') {
-            str_ptr = str;
+// Pipeline pieces must be inlined for the function pointers to go.
+#define STREAM_INLINE static inline __attribute__((always_inline))
+
+typedef char (*stream_next_fn)(void *);
+
+// Source: the columns of a UTF-8 string, starting "offset" columns in
+// (which must be within the string), and going back to the start at
+// the end.
+struct text_src {
+    char const *start;
+    char const *str;
+    char const *glyph;
+    char left;
+    char buf[8];
+};
+
+STREAM_INLINE void text_src_init(struct text_src *s,
+                                 char const *str, int offset)
+{
+    s->start = str;
+    s->str = utf8_skip(str, offset >> 3);
+    s->glyph = oled_next_glyph(&s->str, s->buf) + (offset & 0x07);
+    s->left = 8 - (offset & 0x07);
+}
+
+STREAM_INLINE char text_src_next(void *p)
+{
+    struct text_src *s = p;
+    if (s->left == 0) {
+        if (*s->str == '\0') {
+            s->str = s->start;
         }
+        s->glyph = oled_next_glyph(&s->str, s->buf);
+        s->left = 8;
     }
+    s->left--;
+    return *s->glyph++;
 }
 
-// Like a marquee, but with characters of varying width.
-static void oled_bungee_marquee(char x, char y, char w,
-                                char const *str, int *offset)
+// Source: "len" columns in flash, starting "offset" in, and going
+// back to the start at the end.
+struct flash_src {
+    char const *start;
+    char const *ptr;
+    char const *end;
+};
+
+STREAM_INLINE void flash_src_init(struct flash_src *s,
+                                  char const *cols, int len, int offset)
 {
-    oled_set_page_mode(y, x);
+    s->start = cols;
+    s->ptr = cols + offset;
+    s->end = cols + len;
+}
 
-    i2c_start(OLED_ADDR);
-    i2c_send_byte(OLED_DATA);
-    oled_bungee_marquee_aux(str, *offset, w);
-    i2c_stop();
+STREAM_INLINE char flash_src_next(void *p)
+{
+    struct flash_src *s = p;
+    char c = pgm_read_byte(s->ptr++);
+    if (s->ptr == s->end) {
+        s->ptr = s->start;
+    }
+    return c;
+}
 
-    // Move the pointer along, returning to the start once we hit the end.
-    (*offset)++;
-    if (str[*offset >> 3] == '\0') {
-        *offset &= 7;
+// Source: columns in RAM, such as a row of a bitmap or a span of a
+// framebuffer.
+struct ram_src {
+    char const *ptr;
+};
+
+STREAM_INLINE void ram_src_init(struct ram_src *s, char const *cols)
+{
+    s->ptr = cols;
+}
+
+STREAM_INLINE char ram_src_next(void *p)
+{
+    struct ram_src *s = p;
+    return *s->ptr++;
+}
+
+// Offset stage: drops the first "n" bytes from upstream. Sources can
+// start part way in themselves, which is cheaper, so this is for after
+// stages that change the number of columns.
+STREAM_INLINE void stream_skip(void *up, stream_next_fn up_next, int n)
+{
+    for (; n > 0; n--) {
+        up_next(up);
     }
 }
 
-// Like write, but with vertical wobble.
-static void oled_wobble(char x, char y, char const *str, char *phase)
+// Horizontal scale stage: repeats each upstream column as many times
+// as the next entry of a column map (see Stretched text, below).
+struct hscale {
+    char const *map;
+    char c;
+    char run;
+};
+
+STREAM_INLINE void hscale_init(struct hscale *s, char const *map)
 {
-    {
-        oled_set_page_mode(y, x);
-        char shift = *phase;
-        unsigned char const *str_ptr = (unsigned char const *)str;
-        i2c_start(OLED_ADDR);
-        i2c_send_byte(OLED_DATA);
-        for (; *str_ptr != '\0'; str_ptr++) {
-            char c = *str_ptr;
-            char idx = (32 <= c && c < 128) ? c - 32 : 3;
-            char const *ptr = charset + idx * 8;
-            for (int i = 8; i > 0; i--) {
-                char offset = cos_table_64_4[shift++ & 0x3f];
-                i2c_send_byte(*ptr++ << offset);
-            }
-        }
-        i2c_stop();
+    s->map = map;
+    s->run = 0;
+}
+
+STREAM_INLINE char hscale_next(struct hscale *s,
+                               void *up, stream_next_fn up_next)
+{
+    while (s->run == 0) {
+        s->c = up_next(up);
+        s->run = pgm_read_byte(s->map++);
     }
+    s->run--;
+    return s->c;
+}
 
-    {
-        oled_set_page_mode(y + 1, x);
-        char shift = *phase;
-        unsigned char const *str_ptr = (unsigned char const *)str;
-        i2c_start(OLED_ADDR);
-        i2c_send_byte(OLED_DATA);
-        for (; *str_ptr != '\0'; str_ptr++) {
-            char c = *str_ptr;
-            char idx = (32 <= c && c < 128) ? c - 32 : 3;
-            char const *ptr = charset + idx * 8;
-            for (int i = 8; i > 0; i--) {
-                char offset = 8 - cos_table_64_4[shift++ & 0x3f];
-                i2c_send_byte(*ptr++ >> offset);
-            }
-        }
-        i2c_stop();
+// Vertical shift stage: moves each upstream column down by the next
+// offset from a wave table, and splits it over the pages of a column
+// transfer (see oled_start_clipped_columns), so it sends clip_pages
+// bytes per column. Positions in the table are unsigned Q8.8,
+// interpolated.
+struct vshift {
+    uint8_t const *wave;
+    uint8_t mask;
+    uint8_t frac;
+    char shift;
+    char next;
+    char lo;
+    char hi;
+    char left;
+    int page;
+};
+
+STREAM_INLINE void vshift_init(struct vshift *s, uint8_t const *wave,
+                               uint8_t mask, uq8_8 phase)
+{
+    // All columns are the same fraction of the way between entries.
+    s->wave = wave;
+    s->mask = mask;
+    s->frac = phase & 0xff;
+    s->shift = phase >> 8;
+    s->next = pgm_read_byte(&wave[s->shift++ & mask]);
+    s->left = 0;
+}
+
+STREAM_INLINE char vshift_next(struct vshift *s,
+                               void *up, stream_next_fn up_next)
+{
+    if (s->left == 0) {
+        char c = up_next(up);
+        char prev = s->next;
+        s->next = pgm_read_byte(&s->wave[s->shift++ & s->mask]);
+        char offset = fixed_lerp(prev, s->next, s->frac);
+        // Which of the pages sent gets the top of the column. The bits
+        // shifted out of the bottom spill into the page below.
+        s->page = (offset >> 3) - clip_page_skip;
+        s->lo = c << (offset & 0x07);
+        s->hi = c >> (8 - (offset & 0x07));
+        s->left = clip_pages;
     }
+    s->left--;
+    int page = s->page--;
+    return page == 0 ? s->lo : page == -1 ? s->hi : 0;
+}
 
-    (*phase)++;
+// Invert stage.
+STREAM_INLINE char stream_invert(char c)
+{
+    return ~c;
 }
 
+// Mask stage: keeps only the pixels set in "mask", which usually comes
+// from another source.
+STREAM_INLINE char stream_mask(char c, char mask)
+{
+    return c & mask;
+}
 
-static void oled_contrast(unsigned char c)
+// Sink: sends "count" bytes to the display, for a transfer started by
+// oled_start_clipped or oled_start_clipped_columns, and ends it.
+STREAM_INLINE void bus_sink(void *p, stream_next_fn next, int count)
 {
-    i2c_start(OLED_ADDR);
-    i2c_send_byte(OLED_CMD);
-    i2c_send_byte(OLED_SET_CONTRAST);
-    i2c_send_byte(c);
+    for (; count > 0; count--) {
+        i2c_send_byte(next(p));
+    }
     i2c_stop();
 }
 
+// Sink: writes "count" bytes to memory.
+STREAM_INLINE void ram_sink(void *p, stream_next_fn next,
+                            char *dst, int count)
+{
+    for (; count > 0; count--) {
+        *dst++ = next(p);
+    }
+}
+
+// Sink: sends "count" bytes to column "x" of page "y", clipped, doing
+// its own oled_start_clipped. Pulls all "count" from upstream, even
+// if some or all of it is clipped away.
+STREAM_INLINE void clipped_bus_sink(void *p, stream_next_fn next,
+                                    int x, int y, int count)
+{
+    if (oled_start_clipped(x, y, count)) {
+        stream_skip(p, next, clip_skip);
+        bus_sink(p, next, clip_count);
+        count -= clip_skip + clip_count;
+    }
+    stream_skip(p, next, count);
+}
+
 ////////////////////////////////////////////////////////////////////////
-// And the main program itself...
+// Drawing
 //
 
-char const message_1[] = "My little ssd1306+teensy 2.0 demo. ";
-char const message_2[] = "Look... bendy text! :) ";
-char const message_3[] = "Wobble!";
-
-int main(void)
+// Blit an image to the screen. Y coordinates are pages (multiples of 8 pixels)
+static void oled_blit(int x, int y, char w, char h, char const *image)
 {
-    // CPU prescale must be set with interrupts disabled. They're off
-    // when the CPU starts.
+    // I'd much rather use horizontal addressing mode, but when we set
+    // the start and end column it acutally starts loading memory at start
+    // column & 0xf0. It wraps around to the right place, though. The
+    // bugs of cheap hardware still surprise me.
     //
-    // Don't forget to sync this with F_CPU in the Makefile.
-    cpu_prescale(CPU_8MHz);
-    led_init();
-    led_off();
-    i2c_init();
+    // As it is, we use page mode, and write each page separately.
+    for (int page = 0; page < h; page++) {
+        if (!oled_start_clipped(x, y + page, w)) {
+            continue;
+        }
+        struct ram_src src;
+        ram_src_init(&src, image + page * w + clip_skip);
+        bus_sink(&src, ram_src_next, clip_count);
+    }
+}
 
-    // Initialise USB for debug, but don't wait.
-    usb_init();
+// Displays a string using the ZX Spectrum character set.
+static void oled_write(int x, int y, char const *str)
+{
+    if (oled_start_clipped(x, y, 8 * utf8_len(str))) {
+        struct text_src src;
+        text_src_init(&src, str, clip_skip);
+        bus_sink(&src, text_src_next, clip_count);
+    }
+}
 
-    // Wait for success init of the OLED.
-    while (!oled_init()) {
-        _delay_ms(20);
+STREAM_INLINE char oled_write_inverse_next(void *p)
+{
+    return stream_invert(text_src_next(p));
+}
+
+// Like oled_write, but white on black, for highlighting.
+MAYBE_UNUSED void oled_write_inverse(int x, int y, char const *str)
+{
+    if (oled_start_clipped(x, y, 8 * utf8_len(str))) {
+        struct text_src src;
+        text_src_init(&src, str, clip_skip);
+        bus_sink(&src, oled_write_inverse_next, clip_count);
+    }
+}
+
+// Sends the columns of a glyph, as part of a transfer started by
+// oled_start_clipped. Clipped columns are dropped.
+static void oled_glyph_cols(char const *ptr)
+{
+    if (clip_skip >= 8) {
+        clip_skip -= 8;
+        return;
+    }
+    ptr += clip_skip;
+    for (int i = 8 - clip_skip; i > 0 && clip_count > 0; i--) {
+        i2c_send_byte(*ptr++);
+        clip_count--;
+    }
+    clip_skip = 0;
+}
+
+// Sends a single ASCII character, as for oled_glyph_cols.
+static void oled_glyph(char c)
+{
+    char idx = (32 <= c && c < 128) ? c - 32 : 3;
+    oled_glyph_cols(charset + idx * 8);
+}
+
+// Powers of ten, largest first, so we can convert to decimal by
+// repeated subtraction instead of 32-bit division, which the AVR has
+// to do in software.
+static const unsigned long pow10_table[] PROGMEM = {
+    1000000000, 100000000, 10000000, 1000000, 100000,
+    10000, 1000, 100, 10, 1,
+};
+
+static const char pow10_table_len =
+    sizeof(pow10_table) / sizeof(*pow10_table);
+
+// Displays a number right-aligned in a field "width" characters wide,
+// followed by "units" (which may be NULL). "decimals" is the number of
+// digits after an implied decimal point, so 1234 with 2 decimals is
+// shown as "12.34". Digits are generated most significant first and
+// sent straight to the display, so no string buffer is needed. If the
+// number doesn't fit, the field is filled with '#'s.
+MAYBE_UNUSED void oled_number(int x, int y, char width, long value,
+                              char decimals, char const *units)
+{
+    if (units == NULL) {
+        units = "";
+    }
+    if (!oled_start_clipped(x, y, 8 * (width + utf8_len(units)))) {
+        return;
+    }
+
+    unsigned long n = value < 0 ? -(unsigned long)value : value;
+
+    // Count the digits, keeping at least one before the decimal point.
+    char digits = pow10_table_len;
+    while (digits > decimals + 1 &&
+           n < pgm_read_dword(&pow10_table[pow10_table_len - digits])) {
+        digits--;
+    }
+    char len = digits + (decimals != 0) + (value < 0);
+
+    if (len > width) {
+        for (; width > 0; width--) {
+            oled_glyph('#');
+        }
+    } else {
+        for (; width > len; width--) {
+            oled_glyph(' ');
+        }
+        if (value < 0) {
+            oled_glyph('-');
+        }
+        unsigned long const *pow10_ptr =
+            &pow10_table[pow10_table_len - digits];
+        for (; digits > 0; digits--) {
+            if (digits == decimals) {
+                oled_glyph('.');
+            }
+            unsigned long pow10 = pgm_read_dword(pow10_ptr++);
+            char digit = '0';
+            while (n >= pow10) {
+                n -= pow10;
+                digit++;
+            }
+            oled_glyph(digit);
+        }
+    }
+    char buf[8];
+    while (*units != '\0') {
+        oled_glyph_cols(oled_next_glyph(&units, buf));
+    }
+    i2c_stop();
+}
+
+
+// Displays a string with a scrolling marquee effect.
+// "speed" can be up to 8. "offset" is updated as it scrolls.
+MAYBE_UNUSED void oled_marquee(int x, int y, char w,
+                               char const *str, int *offset, int speed)
+{
+    int len = 8 * utf8_len(str);
+    if (len == 0) {
+        return;
+    }
+    if (oled_start_clipped(x, y, w)) {
+        // Start from the first visible column.
+        int start = (*offset + clip_skip) % len;
+        struct text_src src;
+        text_src_init(&src, str, start);
+        bus_sink(&src, text_src_next, clip_count);
+    }
+
+    // Move the pointer along, returning to the start once we hit the end.
+    *offset += speed;
+    if (*offset >= len) {
+        *offset -= len;
     }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Stretched text
+//
+// Column maps (see tools/src/bin/colmap2teensy.rs) give the number of
+// times to repeat each source column, with the profile worked out at
+// build time. Drawing is then just streaming the map, whatever the
+// profile.
+//
+
+struct stretch_pipe {
+    struct text_src src;
+    struct hscale scale;
+};
+
+STREAM_INLINE char stretch_next(void *p)
+{
+    struct stretch_pipe *s = p;
+    return hscale_next(&s->scale, &s->src, text_src_next);
+}
+
+// Like a marquee, but with the columns stretched by a column map
+// generated for width "w".
+static void oled_stretch_marquee(int x, int y, char w, char const *map,
+                                 char const *str, int *offset)
+{
+    int len = 8 * utf8_len(str);
+    if (len == 0) {
+        return;
+    }
+    if (oled_start_clipped(x, y, w)) {
+        struct stretch_pipe s;
+        text_src_init(&s.src, str, *offset);
+        hscale_init(&s.scale, map);
+        stream_skip(&s, stretch_next, clip_skip);
+        bus_sink(&s, stretch_next, clip_count);
+    }
+
+    // Move the pointer along, returning to the start once we hit the end.
+    if (++*offset >= len) {
+        *offset = 0;
+    }
+}
+
+// Like a marquee, but with characters of varying width.
+MAYBE_UNUSED void oled_bungee_marquee(int x, int y, char const *str,
+                                      int *offset)
+{
+    oled_stretch_marquee(x, y, 128, colmap_bungee_128, str, offset);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Wobbling text
+//
+
+// Number of pages covered by text wobbling over a wave table of
+// amplitude "amplitude" (so offsets of 0 to 2 * amplitude pixels).
+#define WOBBLE_PAGES(amplitude) ((((amplitude) * 2 + 7) >> 3) + 1)
+
+// Wobble wave tables (see WAVES in the Makefile) are all this long.
+#define WOBBLE_WAVE_LEN 64
+
+struct wobble_pipe {
+    struct text_src src;
+    struct vshift shift;
+};
+
+STREAM_INLINE char wobble_next(void *p)
+{
+    struct wobble_pipe *s = p;
+    return vshift_next(&s->shift, &s->src, text_src_next);
+}
+
+// Like write, but with vertical wobble. "wave" is a cosine table of
+// the given amplitude. Each column is sent down all the pages it
+// covers in one go, so the text is only walked once. "phase" is moved
+// along by "speed" each frame. Both are in table entries, and
+// fractions of an entry are interpolated, so slow speeds are smooth.
+MAYBE_UNUSED void oled_wobble(int x, int y, char const *str,
+                              uint8_t const *wave, char amplitude,
+                              uq8_8 *phase, uq8_8 speed)
+{
+    int w = 8 * utf8_len(str);
+    if (oled_start_clipped_columns(x, y, w, WOBBLE_PAGES(amplitude))) {
+        struct wobble_pipe s;
+        text_src_init(&s.src, str, clip_skip);
+        vshift_init(&s.shift, wave, WOBBLE_WAVE_LEN - 1,
+                    *phase + ((uq8_8)clip_skip << 8));
+        bus_sink(&s, wobble_next, clip_count * clip_pages);
+    }
+
+    *phase += speed;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Pre-rendered text
+//
+// The same effects, but with columns pre-rendered into flash (e.g. by
+// text2teensy), so there's no per-character lookup.
+//
+
+MAYBE_UNUSED void oled_write_P(int x, int y, char const *cols, int len)
+{
+    if (oled_start_clipped(x, y, len)) {
+        struct flash_src src;
+        flash_src_init(&src, cols, len, clip_skip);
+        bus_sink(&src, flash_src_next, clip_count);
+    }
+}
+
+// Like oled_marquee, but "offset" is in columns, and "speed" may be
+// anything up to "len".
+static void oled_marquee_P(int x, int y, char w,
+                           char const *cols, int len, int *offset, int speed)
+{
+    if (len == 0) {
+        return;
+    }
+    if (oled_start_clipped(x, y, w)) {
+        // Start from the first visible column.
+        int start = (*offset + clip_skip) % len;
+        struct flash_src src;
+        flash_src_init(&src, cols, len, start);
+        bus_sink(&src, flash_src_next, clip_count);
+    }
+
+    // Move the pointer along, returning to the start once we hit the end.
+    *offset += speed;
+    if (*offset >= len) {
+        *offset -= len;
+    }
+}
+
+struct stretch_P_pipe {
+    struct flash_src src;
+    struct hscale scale;
+};
+
+STREAM_INLINE char stretch_P_next(void *p)
+{
+    struct stretch_P_pipe *s = p;
+    return hscale_next(&s->scale, &s->src, flash_src_next);
+}
+
+static void oled_stretch_marquee_P(int x, int y, char w, char const *map,
+                                   char const *cols, int len, int *offset)
+{
+    if (len == 0) {
+        return;
+    }
+    if (oled_start_clipped(x, y, w)) {
+        struct stretch_P_pipe s;
+        flash_src_init(&s.src, cols, len, *offset);
+        hscale_init(&s.scale, map);
+        stream_skip(&s, stretch_P_next, clip_skip);
+        bus_sink(&s, stretch_P_next, clip_count);
+    }
+
+    // Move the pointer along, returning to the start once we hit the end.
+    if (++*offset >= len) {
+        *offset = 0;
+    }
+}
+
+static void oled_bungee_marquee_P(int x, int y,
+                                  char const *cols, int len, int *offset)
+{
+    oled_stretch_marquee_P(x, y, 128, colmap_bungee_128, cols, len, offset);
+}
+
+struct wobble_P_pipe {
+    struct flash_src src;
+    struct vshift shift;
+};
+
+STREAM_INLINE char wobble_P_next(void *p)
+{
+    struct wobble_P_pipe *s = p;
+    return vshift_next(&s->shift, &s->src, flash_src_next);
+}
+
+static void oled_wobble_P(int x, int y, char const *cols, int len,
+                          uint8_t const *wave, char amplitude,
+                          uq8_8 *phase, uq8_8 speed)
+{
+    if (oled_start_clipped_columns(x, y, len, WOBBLE_PAGES(amplitude))) {
+        struct wobble_P_pipe s;
+        flash_src_init(&s.src, cols, len, clip_skip);
+        vshift_init(&s.shift, wave, WOBBLE_WAVE_LEN - 1,
+                    *phase + ((uq8_8)clip_skip << 8));
+        bus_sink(&s, wobble_P_next, clip_count * clip_pages);
+    }
+
+    *phase += speed;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Charts
+//
+// Sparklines and bar graphs of live values, scrolling left as samples
+// come in. The last "w" samples are kept in a ring buffer, as heights
+// in pixels, so the chart can be regenerated a column at a time
+// without a framebuffer.
+//
+// With HW_SCROLL, each new sample scrolls the chart left a column in
+// the display, and only the new column is sent. That needs the one
+// column content scroll command, which the SSD1315 and later SSD1306
+// parts have, and two frames (about 20ms) between scrolls. Without
+// it, the chart is resent as one column transfer. Either way, the
+// label of the latest value is only resent when it changes.
+//
+
+#define CHART_SPARKLINE 0
+#define CHART_BARS      1
+
+struct chart {
+    // Position and size, in columns and pages.
+    int x;
+    char y;
+    char w;
+    char h;
+    char style;
+    // Values at the bottom and top of the chart.
+    long lo;
+    long hi;
+    // "w" sample heights, oldest at "head".
+    char *ring;
+    int head;
+    // Characters of label to the right of the chart (0 for none), and
+    // the value it's showing.
+    char label;
+    char decimals;
+    long shown;
+};
+
+// Mask of the pixels of "page" between rows "top" and "bottom"
+// inclusive.
+static inline char span_mask(char page, char top, char bottom)
+{
+    char first = page * 8;
+    char last = first + 7;
+    if (top > last || bottom < first) {
+        return 0;
+    }
+    char mask = 0xff;
+    if (top > first) {
+        mask &= 0xff << (top - first);
+    }
+    if (bottom < last) {
+        mask &= 0xff >> (last - bottom);
+    }
+    return mask;
+}
+
+// Height of "value" in pixels, clamped to the chart.
+static char chart_height(struct chart const *c, long value)
+{
+    if (value <= c->lo) {
+        return 0;
+    }
+    if (value >= c->hi) {
+        return c->h * 8 - 1;
+    }
+    return (value - c->lo) * (c->h * 8 - 1) / (c->hi - c->lo);
+}
+
+// Source: the columns of a chart from the "i"th oldest sample, as
+// clip_pages bytes per column for a column transfer.
+struct chart_src {
+    struct chart const *c;
+    char i;
+    char top;
+    char bottom;
+    char page;
+    char left;
+};
+
+STREAM_INLINE void chart_src_init(struct chart_src *s,
+                                  struct chart const *c, char i)
+{
+    s->c = c;
+    s->i = i;
+    s->left = 0;
+}
+
+STREAM_INLINE char chart_src_next(void *p)
+{
+    struct chart_src *s = p;
+    if (s->left == 0) {
+        struct chart const *c = s->c;
+        int pos = c->head + s->i;
+        if (pos >= c->w) {
+            pos -= c->w;
+        }
+        char bottom = c->h * 8 - 1;
+        char top = bottom - c->ring[pos];
+        if (c->style == CHART_BARS) {
+            s->top = top;
+            s->bottom = bottom;
+        } else {
+            // Join up with the previous sample.
+            char prev = s->i == 0 ? top :
+                bottom - c->ring[pos == 0 ? c->w - 1 : pos - 1];
+            s->top = top < prev ? top : prev;
+            s->bottom = top < prev ? prev : top;
+        }
+        s->i++;
+        s->page = clip_page_skip;
+        s->left = clip_pages;
+    }
+    s->left--;
+    return span_mask(s->page++, s->top, s->bottom);
+}
+
+// Sends "n" columns of the chart, starting at the "i"th oldest sample.
+static void chart_send(struct chart const *c, char i, char n)
+{
+    if (oled_start_clipped_columns(c->x + i, c->y, n, c->h)) {
+        struct chart_src src;
+        chart_src_init(&src, c, i + clip_skip);
+        bus_sink(&src, chart_src_next, clip_count * clip_pages);
+    }
+}
+
+// Updates the label, if the value's changed.
+static void chart_label(struct chart *c, long value)
+{
+    if (c->label != 0 && value != c->shown) {
+        oled_number(c->x + c->w, c->y, c->label, value, c->decimals, NULL);
+        c->shown = value;
+    }
+}
+
+// Starts a chart, with the ring buffer filled with "value", and draws it.
+MAYBE_UNUSED void chart_init(struct chart *c, long value)
+{
+    memset(c->ring, chart_height(c, value), c->w);
+    c->head = 0;
+    chart_send(c, 0, c->w);
+    c->shown = ~value;
+    chart_label(c, value);
+}
+
+// Adds a sample, scrolling the chart along.
+MAYBE_UNUSED void chart_push(struct chart *c, long value)
+{
+    c->ring[c->head] = chart_height(c, value);
+    if (++c->head == c->w) {
+        c->head = 0;
+    }
+#ifdef HW_SCROLL
+    oled_scroll_left(c->y, c->h, c->x, c->w);
+    chart_send(c, c->w - 1, 1);
+#else
+    chart_send(c, 0, c->w);
+#endif // HW_SCROLL
+    chart_label(c, value);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rotation
+//
+// For panels mounted any way round. Half turns are done by the
+// display, which can flip its output both ways. In a quarter turn the
+// screen is 32 pixels wide and 128 high, and each 8x8 cell of it is
+// the bits of 8 bytes of a page on their side, so cells are
+// transposed on the way out. 270 degrees is 90 degrees flipped by the
+// display, so that's no slower.
+//
+// Rotated drawing works in whole cells: x and y are in units of 8
+// pixels, and it clips to the screen rather than the clip rectangle.
+//
+
+#define ROTATE_0   0
+#define ROTATE_90  1 // The panel's right-hand edge at the top
+#define ROTATE_180 2
+#define ROTATE_270 3
+
+static char oled_rotation = VFLIP ? ROTATE_180 : ROTATE_0;
+
+// Size of the rotated screen, in cells.
+static inline char rot_cols(void)
+{
+    return (oled_rotation & ROTATE_90) ? OLED_PAGES : OLED_WIDTH / 8;
+}
+
+static inline char rot_rows(void)
+{
+    return (oled_rotation & ROTATE_90) ? OLED_WIDTH / 8 : OLED_PAGES;
+}
+
+// Sets the rotation. The display only flips data as it's written, so
+// redraw everything afterwards.
+MAYBE_UNUSED void oled_set_rotation(char rotation)
+{
+    char flip = rotation & ROTATE_180;
+    oled_rotation = rotation;
+    i2c_start(OLED_ADDR);
+    i2c_send_byte(OLED_CMD);
+    i2c_send_byte(OLED_SET_SEGMENT_REMAP | (flip ? 1 : 0));
+    i2c_send_byte(OLED_SET_COM_SCAN_DIR | (flip ? 8 : 0));
+    i2c_stop();
+}
+
+// Transposes an 8x8 bit matrix: bit i of src[j] becomes bit j of
+// dst[i]. On the AVR each row is shifted out through the carry into
+// the columns, two cycles a bit, with all of them kept in registers.
+static void bits_transpose(char const *src, char *dst)
+{
+    char d0 = 0, d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0, d7 = 0;
+    for (int j = 0; j < 8; j++) {
+        char b = src[j];
+#ifdef __AVR__
+        asm("lsr %[b]\n\tror %[d0]\n\t"
+            "lsr %[b]\n\tror %[d1]\n\t"
+            "lsr %[b]\n\tror %[d2]\n\t"
+            "lsr %[b]\n\tror %[d3]\n\t"
+            "lsr %[b]\n\tror %[d4]\n\t"
+            "lsr %[b]\n\tror %[d5]\n\t"
+            "lsr %[b]\n\tror %[d6]\n\t"
+            "lsr %[b]\n\tror %[d7]"
+            : [b] "+r" (b),
+              [d0] "+r" (d0), [d1] "+r" (d1), [d2] "+r" (d2), [d3] "+r" (d3),
+              [d4] "+r" (d4), [d5] "+r" (d5), [d6] "+r" (d6), [d7] "+r" (d7));
+#else
+        d0 = (d0 >> 1) | (b << 7);
+        d1 = (d1 >> 1) | (b << 6 & 0x80);
+        d2 = (d2 >> 1) | (b << 5 & 0x80);
+        d3 = (d3 >> 1) | (b << 4 & 0x80);
+        d4 = (d4 >> 1) | (b << 3 & 0x80);
+        d5 = (d5 >> 1) | (b << 2 & 0x80);
+        d6 = (d6 >> 1) | (b << 1 & 0x80);
+        d7 = (d7 >> 1) | (b & 0x80);
+#endif
+    }
+    dst[0] = d0; dst[1] = d1; dst[2] = d2; dst[3] = d3;
+    dst[4] = d4; dst[5] = d5; dst[6] = d6; dst[7] = d7;
+}
+
+// In a quarter turn, sends "n" transposed cells from "buf" to cells
+// (x, y) onwards. They're all in the same columns, on neighbouring
+// pages, so it's a single transfer in vertical mode, sending each
+// cell's columns last first.
+static void rot_send_cells(char x, char y, char n, char const *buf)
+{
+    oled_set_vertical_mode(x, n, OLED_WIDTH - 8 - y * 8);
+    i2c_start(OLED_ADDR);
+    i2c_send_byte(OLED_DATA);
+    for (char i = 8; i > 0; i--) {
+        for (char m = 0; m < n; m++) {
+            i2c_send_byte(buf[m * 8 + i - 1]);
+        }
+    }
+    i2c_stop();
+}
+
+// Clips a row of "w" cells at (x, y) to the rotated screen. Returns
+// the number visible, and sets clip_skip to the number dropped from
+// the left.
+static char rot_clip(int x, int y, int w)
+{
+    if (y < 0 || y >= rot_rows() || x >= rot_cols() || x + w <= 0) {
+        return 0;
+    }
+    clip_skip = x < 0 ? -x : 0;
+    int right = x + w > rot_cols() ? rot_cols() : x + w;
+    return right - x - clip_skip;
+}
+
+// Like oled_write, but for any rotation, and at cell (x, y).
+MAYBE_UNUSED void oled_write_rotated(int x, int y, char const *str)
+{
+    if (!(oled_rotation & ROTATE_90)) {
+        oled_write(x * 8, y, str);
+        return;
+    }
+    char n = rot_clip(x, y, utf8_len(str));
+    if (n == 0) {
+        return;
+    }
+    str = utf8_skip(str, clip_skip);
+    char buf[OLED_PAGES * 8];
+    for (char m = 0; m < n; m++) {
+        char ext[8];
+        bits_transpose(oled_next_glyph(&str, ext), buf + m * 8);
+    }
+    rot_send_cells(x + clip_skip, y, n, buf);
+}
+
+// Like oled_blit, but for any rotation, and at cell (x, y). "w" is
+// still in columns, with any part cell at the end padded with blanks.
+MAYBE_UNUSED void oled_blit_rotated(int x, int y, char w, char h,
+                                    char const *image)
+{
+    if (!(oled_rotation & ROTATE_90)) {
+        oled_blit(x * 8, y, w, h, image);
+        return;
+    }
+    for (char page = 0; page < h; page++) {
+        char n = rot_clip(x, y + page, (w + 7) >> 3);
+        if (n == 0) {
+            continue;
+        }
+        char buf[OLED_PAGES * 8];
+        char const *row = image + page * w;
+        for (char m = 0; m < n; m++) {
+            char cell[8];
+            int col = (clip_skip + m) * 8;
+            for (int i = 0; i < 8; i++, col++) {
+                cell[i] = col < w ? row[col] : 0;
+            }
+            bits_transpose(cell, buf + m * 8);
+        }
+        rot_send_cells(x + clip_skip, y + page, n, buf);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Framebuffer
+//
+// Things that overlap, like sprites moving over other content, are
+// drawn into a buffer in RAM, which is then sent in one go.
+//
+// The buffer is either the whole screen (512 bytes), or a single page
+// (128 bytes) for the page compositor, which draws a scene a page at a
+// time and sends each page as soon as it's done. Drawing routines
+// don't care which: they clip against the pages held as well as the
+// clip rectangle. A scene is a function making fb_ calls, in order
+// from back to front, which fb_render or page_render calls once per
+// frame or once per page. As a scene may be drawn more than once a
+// frame, the fb_ effects take their state by value, and it's up to
+// the caller to move them on between frames.
+//
+
+// The buffers for fb_render and page_render.
+static char fb_screen[OLED_PAGES * OLED_WIDTH];
+static char fb_page[OLED_WIDTH];
+
+// The buffer being drawn into, holding pages fb_top up to fb_bottom.
+static char *fb_buf;
+static char fb_top;
+static char fb_bottom;
+
+// Returns the row of the buffer for "page", or NULL if it's not held
+// or not in the clip rectangle.
+static inline char *fb_row(int page)
+{
+    if (page < fb_top || page >= fb_bottom ||
+        page < clip_top || page >= clip_bottom) {
+        return NULL;
+    }
+    return fb_buf + (page - fb_top) * OLED_WIDTH;
+}
+
+// Sink: like clipped_bus_sink, but into the buffer.
+STREAM_INLINE void fb_clipped_sink(void *p, stream_next_fn next,
+                                   int x, int y, int count)
+{
+    char *row = fb_row(y);
+    if (row != NULL && clip_columns(x, count)) {
+        stream_skip(p, next, clip_skip);
+        ram_sink(p, next, row + x + clip_skip, clip_count);
+        count -= clip_skip + clip_count;
+    }
+    stream_skip(p, next, count);
+}
+
+// Like oled_start_clipped_columns, but for the buffer. Sets
+// clip_page_skip and clip_pages, and returns the row of the first
+// visible page, or NULL if none of it is visible.
+static char *fb_clip_columns(int x, int y, int w, int h)
+{
+    int top = y;
+    if (top < clip_top) {
+        top = clip_top;
+    }
+    if (top < fb_top) {
+        top = fb_top;
+    }
+    int bottom = y + h;
+    if (bottom > clip_bottom) {
+        bottom = clip_bottom;
+    }
+    if (bottom > fb_bottom) {
+        bottom = fb_bottom;
+    }
+    if (top >= bottom || !clip_columns(x, w)) {
+        return NULL;
+    }
+    clip_page_skip = top - y;
+    clip_pages = bottom - top;
+    return fb_buf + (top - fb_top) * OLED_WIDTH;
+}
+
+// Sink: writes "count" columns of clip_pages bytes each, as from a
+// column transfer, down the buffer starting at "dst".
+STREAM_INLINE void fb_column_sink(void *p, stream_next_fn next,
+                                  char *dst, int count)
+{
+    for (; count > 0; count--, dst++) {
+        char *ptr = dst;
+        for (char i = clip_pages; i > 0; i--, ptr += OLED_WIDTH) {
+            *ptr = next(p);
+        }
+    }
+}
+
+MAYBE_UNUSED void fb_clear(void)
+{
+    memset(fb_buf, 0, (fb_bottom - fb_top) * OLED_WIDTH);
+}
+
+// Like oled_blit, but into the buffer.
+MAYBE_UNUSED void fb_blit(int x, int y, char w, char h, char const *image)
+{
+    if (!clip_columns(x, w)) {
+        return;
+    }
+    for (int page = 0; page < h; page++) {
+        char *row = fb_row(y + page);
+        if (row == NULL) {
+            continue;
+        }
+        struct ram_src src;
+        ram_src_init(&src, image + page * w + clip_skip);
+        ram_sink(&src, ram_src_next, row + x + clip_skip, clip_count);
+    }
+}
+
+// Like oled_write, but into the buffer.
+MAYBE_UNUSED void fb_write(int x, int y, char const *str)
+{
+    char *row = fb_row(y);
+    if (row == NULL || !clip_columns(x, 8 * utf8_len(str))) {
+        return;
+    }
+    struct text_src src;
+    text_src_init(&src, str, clip_skip);
+    ram_sink(&src, text_src_next, row + x + clip_skip, clip_count);
+}
+
+// Like oled_write_P, but into the buffer.
+MAYBE_UNUSED void fb_write_P(int x, int y, char const *cols, int len)
+{
+    char *row = fb_row(y);
+    if (row == NULL || !clip_columns(x, len)) {
+        return;
+    }
+    struct flash_src src;
+    flash_src_init(&src, cols, len, clip_skip);
+    ram_sink(&src, flash_src_next, row + x + clip_skip, clip_count);
+}
+
+// Like oled_marquee_P, but into the buffer, and it doesn't move
+// "offset" along.
+MAYBE_UNUSED void fb_marquee_P(int x, int y, char w,
+                               char const *cols, int len, int offset)
+{
+    char *row = fb_row(y);
+    if (len == 0 || row == NULL || !clip_columns(x, w)) {
+        return;
+    }
+    int start = (offset + clip_skip) % len;
+    struct flash_src src;
+    flash_src_init(&src, cols, len, start);
+    ram_sink(&src, flash_src_next, row + x + clip_skip, clip_count);
+}
+
+// Like oled_wobble_P, but into the buffer, and it doesn't move "phase"
+// along.
+MAYBE_UNUSED void fb_wobble_P(int x, int y, char const *cols, int len,
+                              uint8_t const *wave, char amplitude,
+                              uq8_8 phase)
+{
+    char *row = fb_clip_columns(x, y, len, WOBBLE_PAGES(amplitude));
+    if (row == NULL) {
+        return;
+    }
+    struct wobble_P_pipe s;
+    flash_src_init(&s.src, cols, len, clip_skip);
+    vshift_init(&s.shift, wave, WOBBLE_WAVE_LEN - 1,
+                phase + ((uq8_8)clip_skip << 8));
+    fb_column_sink(&s, wobble_P_next, row + x + clip_skip, clip_count);
+}
+
+// Sends the buffer to the display.
+MAYBE_UNUSED void fb_flush(void)
+{
+    if (fb_bottom - fb_top == OLED_PAGES) {
+        // The whole screen, in one go.
+        oled_sequence(oled_full_screen_instrs, oled_full_screen_instrs_len);
+    } else {
+        oled_set_page_mode(fb_top, 0);
+    }
+
+    i2c_start(OLED_ADDR);
+    i2c_send_byte(OLED_DATA);
+    struct ram_src src;
+    ram_src_init(&src, fb_buf);
+    bus_sink(&src, ram_src_next, (fb_bottom - fb_top) * OLED_WIDTH);
+}
+
+typedef void (*scene_fn)(void);
+
+// Draws a scene into a whole-screen framebuffer and sends it. Takes
+// 512 bytes of RAM, but the scene is only drawn once.
+MAYBE_UNUSED void fb_render(scene_fn scene)
+{
+    fb_buf = fb_screen;
+    fb_top = 0;
+    fb_bottom = OLED_PAGES;
+    fb_clear();
+    scene();
+    fb_flush();
+}
+
+// Draws a scene a page at a time, sending each page as it's done.
+// Only needs 128 bytes of RAM, but the scene is drawn once per page,
+// so it's worth it being quick to clip away.
+MAYBE_UNUSED void page_render(scene_fn scene)
+{
+    fb_buf = fb_page;
+    for (char page = 0; page < OLED_PAGES; page++) {
+        fb_top = page;
+        fb_bottom = page + 1;
+        fb_clear();
+        scene();
+        fb_flush();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Primitives
+//
+// Lines, rectangles and circles, drawn into the buffer. Coordinates are
+// in pixels. Everything is broken into horizontal and vertical spans,
+// which are a run of columns ORed (or cleared, or inverted) with the
+// same bit mask on a page. A tall span only needs a mask at its ends.
+// Each pixel is drawn once, so inverting works.
+//
+
+#define DRAW_CLEAR  0
+#define DRAW_SET    1
+#define DRAW_INVERT 2
+
+// Combines "mask" into "w" bytes at "dst".
+static void fb_mask_run(char *dst, int w, char mask, char colour)
+{
+    if (mask == 0xff && colour != DRAW_INVERT) {
+        memset(dst, colour == DRAW_SET ? 0xff : 0x00, w);
+        return;
+    }
+    switch (colour) {
+    case DRAW_CLEAR:
+        mask = ~mask;
+        for (; w > 0; w--) {
+            *dst++ &= mask;
+        }
+        break;
+    case DRAW_SET:
+        for (; w > 0; w--) {
+            *dst++ |= mask;
+        }
+        break;
+    case DRAW_INVERT:
+        for (; w > 0; w--) {
+            *dst++ ^= mask;
+        }
+        break;
+    }
+}
+
+static void fb_fill_rect(int x, int y, int w, int h, char colour)
+{
+    if (w <= 0 || h <= 0 || !clip_columns(x, w)) {
+        return;
+    }
+    int bottom = y + h - 1;
+    // Only go over the pages being drawn.
+    int first = y >> 3 < fb_top ? fb_top : y >> 3;
+    int last = bottom >> 3 >= fb_bottom ? fb_bottom - 1 : bottom >> 3;
+    for (int page = first; page <= last; page++) {
+        char *row = fb_row(page);
+        if (row == NULL) {
+            continue;
+        }
+        char mask = 0xff;
+        if (page == y >> 3) {
+            mask &= 0xff << (y & 0x07);
+        }
+        if (page == bottom >> 3) {
+            mask &= 0xff >> (7 - (bottom & 0x07));
+        }
+        fb_mask_run(row + x + clip_skip, clip_count, mask, colour);
+    }
+}
+
+static void fb_hline(int x, int y, int w, char colour)
+{
+    fb_fill_rect(x, y, w, 1, colour);
+}
+
+static void fb_vline(int x, int y, int h, char colour)
+{
+    fb_fill_rect(x, y, 1, h, colour);
+}
+
+MAYBE_UNUSED void fb_rect(int x, int y, int w, int h, char colour)
+{
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    fb_hline(x, y, w, colour);
+    if (h > 1) {
+        fb_hline(x, y + h - 1, w, colour);
+    }
+    fb_vline(x, y + 1, h - 2, colour);
+    if (w > 1) {
+        fb_vline(x + w - 1, y + 1, h - 2, colour);
+    }
+}
+
+// Bresenham's line, from (x0, y0) to (x1, y1) inclusive, drawn as a
+// span for each run of pixels along the major axis.
+MAYBE_UNUSED void fb_line(int x0, int y0, int x1, int y1, char colour)
+{
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    if (dx >= dy) {
+        // Mostly horizontal: go left to right, a span per row.
+        if (x0 > x1) {
+            int t = x0; x0 = x1; x1 = t;
+            t = y0; y0 = y1; y1 = t;
+        }
+        int step = y0 < y1 ? 1 : -1;
+        int err = dx >> 1;
+        int start = x0;
+        for (int x = x0; x <= x1; x++) {
+            err -= dy;
+            if (err < 0 || x == x1) {
+                fb_hline(start, y0, x - start + 1, colour);
+                start = x + 1;
+                y0 += step;
+                err += dx;
+            }
+        }
+    } else {
+        // Mostly vertical: go top to bottom, a span per column.
+        if (y0 > y1) {
+            int t = x0; x0 = x1; x1 = t;
+            t = y0; y0 = y1; y1 = t;
+        }
+        int step = x0 < x1 ? 1 : -1;
+        int err = dy >> 1;
+        int start = y0;
+        for (int y = y0; y <= y1; y++) {
+            err -= dx;
+            if (err < 0 || y == y1) {
+                fb_vline(x0, start, y - start + 1, colour);
+                start = y + 1;
+                x0 += step;
+                err += dy;
+            }
+        }
+    }
+}
+
+// Spans of a circle's outline either side of the centre, from "a" to
+// "b" pixels out (joined into one if "a" is 0): horizontal on row "y",
+// or vertical on column "x".
+static void fb_hspans(int cx, int y, int a, int b, char colour)
+{
+    if (a == 0) {
+        fb_hline(cx - b, y, 2 * b + 1, colour);
+    } else if (a <= b) {
+        fb_hline(cx - b, y, b - a + 1, colour);
+        fb_hline(cx + a, y, b - a + 1, colour);
+    }
+}
+
+static void fb_vspans(int x, int cy, int a, int b, char colour)
+{
+    if (a == 0) {
+        fb_vline(x, cy - b, 2 * b + 1, colour);
+    } else if (a <= b) {
+        fb_vline(x, cy - b, b - a + 1, colour);
+        fb_vline(x, cy + a, b - a + 1, colour);
+    }
+}
+
+// Next step of the midpoint circle algorithm, from (x, y) to (x + 1,
+// the returned y), updating the decision variable "d".
+static inline int circle_step(int x, int y, int *d)
+{
+    if (*d < 0) {
+        *d += 2 * x + 3;
+        return y;
+    }
+    *d += 2 * (x - y) + 5;
+    return y - 1;
+}
+
+// Midpoint circle of radius "r" around (cx, cy). Going round an octant,
+// x steps along while y stays put for a run of pixels, which is a
+// horizontal span near the top and bottom, and a vertical one down the
+// left and right.
+MAYBE_UNUSED void fb_circle(int cx, int cy, int r, char colour)
+{
+    if (r <= 0) {
+        if (r == 0) {
+            fb_hline(cx, cy, 1, colour);
+        }
+        return;
+    }
+    int d = 1 - r;
+    int start = 0;
+    for (int x = 0, y = r; x <= y; x++) {
+        int next_y = circle_step(x, y, &d);
+        if (next_y != y || x + 1 > next_y) {
+            fb_hspans(cx, cy - y, start, x, colour);
+            fb_hspans(cx, cy + y, start, x, colour);
+            // The point on the diagonal is left to the rows.
+            int end = x < y ? x : y - 1;
+            fb_vspans(cx - y, cy, start, end, colour);
+            fb_vspans(cx + y, cy, start, end, colour);
+            start = x + 1;
+        }
+        y = next_y;
+    }
+}
+
+// Filled circle, as a vertical span per column: those near the middle
+// as x steps along, and those at the sides once each run of x ends.
+MAYBE_UNUSED void fb_fill_circle(int cx, int cy, int r, char colour)
+{
+    int d = 1 - r;
+    for (int x = 0, y = r; x <= y; x++) {
+        int next_y = circle_step(x, y, &d);
+        fb_vline(cx - x, cy - y, 2 * y + 1, colour);
+        if (x != 0) {
+            fb_vline(cx + x, cy - y, 2 * y + 1, colour);
+        }
+        if ((next_y != y || x + 1 > next_y) && y > x) {
+            fb_vline(cx - y, cy - x, 2 * x + 1, colour);
+            fb_vline(cx + y, cy - x, 2 * x + 1, colour);
+        }
+        y = next_y;
+    }
+}
+
+// Sets, clears or inverts a single pixel.
+MAYBE_UNUSED void fb_pixel(int x, int y, char colour)
+{
+    if (x < clip_left || x >= clip_right) {
+        return;
+    }
+    char *row = fb_row(y >> 3);
+    if (row == NULL) {
+        return;
+    }
+    char mask = 1 << (y & 0x07);
+    switch (colour) {
+    case DRAW_CLEAR:
+        row[x] &= ~mask;
+        break;
+    case DRAW_SET:
+        row[x] |= mask;
+        break;
+    case DRAW_INVERT:
+        row[x] ^= mask;
+        break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Greyscale
+//
+// Four levels of grey on the 1-bit panel, by flicking between two
+// bitplanes faster than the eye can follow. The high plane is shown
+// two frames in three and the low plane one, so each pixel is lit for
+// as many thirds of the time as its level. A plane is only sent when
+// the one shown changes, and then only the runs of bytes where the two
+// planes differ, so areas of black and white cost nothing.
+//
+// With GREY_CONTRAST, the planes alternate instead, with the low one
+// at half the contrast. That's the same four levels (roughly, as
+// contrast isn't quite linear) in two frames rather than three.
+//
+// We can't see the panel's refresh from here, so frames are paced by
+// Timer0, every GREY_FRAME_TICKS of 1024 cycles. Ideally it's a whole
+// number of panel refreshes (about 5ms at the default oscillator
+// setting), and must be longer than it takes to send a plane. Tune it
+// by eye for the least beating.
+//
+// The high plane is fb_render's buffer, so greyscale only needs
+// another 512 bytes.
+//
+
+#define GREY_BLACK 0
+#define GREY_DARK  1
+#define GREY_LIGHT 2
+#define GREY_WHITE 3
+
+#define GREY_FRAME_TICKS 78
+
+#define GREY_CONTRAST_HIGH 0xfe
+#define GREY_CONTRAST_LOW  0x7f
+
+// Unchanged gaps shorter than this are sent, rather than starting
+// another transfer.
+#define GREY_GAP 8
+
+static char grey_low[OLED_PAGES * OLED_WIDTH];
+
+// The plane a scene is being drawn for, and the one on the panel.
+static char grey_plane;
+static char grey_shown;
+// Position in the sequence of planes.
+static int grey_step;
+
+static inline char *grey_buf(char plane)
+{
+    return plane ? fb_screen : grey_low;
+}
+
+// The colour to draw grey "level" in, for the plane being drawn. Use
+// with the fb_ primitives in a grey scene.
+static inline char grey_colour(char level)
+{
+    return (level >> grey_plane) & 1 ? DRAW_SET : DRAW_CLEAR;
+}
+
+// Like fb_blit, but for bitplanes in flash from image2teensy --grey.
+MAYBE_UNUSED void grey_blit_P(int x, int y, char w, char h, char const *image)
+{
+    if (!clip_columns(x, w)) {
+        return;
+    }
+    image += grey_plane * w * h;
+    for (int page = 0; page < h; page++) {
+        char *row = fb_row(y + page);
+        if (row == NULL) {
+            continue;
+        }
+        memcpy_P(row + x + clip_skip, image + page * w + clip_skip,
+                 clip_count);
+    }
+}
+
+// Sends the bytes of page "page" that differ between "from" (what's on
+// the panel) and "to".
+static void grey_send_changes(char page, char const *from, char const *to)
+{
+    int x = 0;
+    while (1) {
+        for (; x < OLED_WIDTH && from[x] == to[x]; x++) {
+        }
+        if (x == OLED_WIDTH) {
+            return;
+        }
+        // Extend the run until there's a long enough gap.
+        int start = x;
+        int end = x;
+        for (int gap = 0; x < OLED_WIDTH && gap < GREY_GAP; x++) {
+            if (from[x] != to[x]) {
+                end = x + 1;
+                gap = 0;
+            } else {
+                gap++;
+            }
+        }
+        oled_set_page_mode(page, start);
+        i2c_start(OLED_ADDR);
+        i2c_send_byte(OLED_DATA);
+        struct ram_src src;
+        ram_src_init(&src, to + start);
+        bus_sink(&src, ram_src_next, end - start);
+        x = end;
+    }
+}
+
+// Starts greyscale, with both planes blank, and starts the frame timer.
+MAYBE_UNUSED void grey_start(void)
+{
+    memset(fb_screen, 0, sizeof(fb_screen));
+    memset(grey_low, 0, sizeof(grey_low));
+    oled_clear();
+    grey_shown = 1;
+    grey_step = 0;
+
+    // CTC mode, at CPU clock / 1024.
+    TCCR0A = 1 << WGM01;
+    OCR0A = GREY_FRAME_TICKS - 1;
+    TCNT0 = 0;
+    TIFR0 = 1 << OCF0A;
+    TCCR0B = (1 << CS02) | (1 << CS00);
+}
+
+// Stops the frame timer, leaving the high plane on the panel.
+MAYBE_UNUSED void grey_stop(void)
+{
+    TCCR0B = 0;
+    if (grey_shown != 1) {
+        for (char page = 0; page < OLED_PAGES; page++) {
+            grey_send_changes(page, grey_low + page * OLED_WIDTH,
+                              fb_screen + page * OLED_WIDTH);
+        }
+        grey_shown = 1;
+    }
+#ifdef GREY_CONTRAST
+    oled_contrast(GREY_CONTRAST_LOW);
+#endif // GREY_CONTRAST
+}
+
+// Draws a scene into both planes, a page at a time. It's called once
+// per page for each plane, with grey_plane set. Changes to the plane
+// on the panel are sent straight away, so the panel keeps matching it.
+MAYBE_UNUSED void grey_render(scene_fn scene)
+{
+    fb_buf = fb_page;
+    for (char plane = 0; plane < 2; plane++) {
+        grey_plane = plane;
+        char *dst = grey_buf(plane);
+        for (char page = 0; page < OLED_PAGES; page++, dst += OLED_WIDTH) {
+            fb_top = page;
+            fb_bottom = page + 1;
+            fb_clear();
+            scene();
+            if (plane == grey_shown) {
+                grey_send_changes(page, dst, fb_page);
+            }
+            memcpy(dst, fb_page, OLED_WIDTH);
+        }
+    }
+}
+
+// Waits for the next frame, and shows its plane.
+MAYBE_UNUSED void grey_frame(void)
+{
+#ifdef GREY_CONTRAST
+    static const char sequence[] = { 1, 0 };
+#else
+    static const char sequence[] = { 1, 1, 0 };
+#endif // GREY_CONTRAST
+    char plane = sequence[grey_step];
+    if (++grey_step == sizeof(sequence)) {
+        grey_step = 0;
+    }
+
+    while (!(TIFR0 & (1 << OCF0A))) {
+    }
+    TIFR0 = 1 << OCF0A;
+
+    if (plane != grey_shown) {
+        char const *from = grey_buf(grey_shown);
+        char const *to = grey_buf(plane);
+        for (char page = 0; page < OLED_PAGES; page++) {
+            grey_send_changes(page, from, to);
+            from += OLED_WIDTH;
+            to += OLED_WIDTH;
+        }
+        grey_shown = plane;
+#ifdef GREY_CONTRAST
+        oled_contrast(plane ? GREY_CONTRAST_HIGH : GREY_CONTRAST_LOW);
+#endif // GREY_CONTRAST
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Sprites
+//
+// 16x16 sprites, drawn into the buffer at any pixel position. An
+// atlas of them is built from a sprite sheet (see sprites/ and
+// tools/src/bin/sprite2teensy.rs), with 16 bits of image and 16 of
+// mask per column. Each column is shifted into the three pages it can
+// cover and combined with the buffer a byte at a time.
+//
+
+#define SPRITE_SIZE  16
+#define SPRITE_BYTES (SPRITE_SIZE * 4)
+
+// How a sprite combines with what's underneath.
+#define SPRITE_MASKED 0 // Replaces it where the mask is set
+#define SPRITE_OR     1 // Sets the image's pixels
+#define SPRITE_XOR    2 // Inverts the image's pixels
+
+struct sprite {
+    int x;
+    int y;
+    char image;
+    char mode;
+};
+
+// Byte "k" (0 to 2) of a 16-bit sprite column moved down "shift" pixels.
+// There's only a byte 2 if "shift" isn't 0: unsigned int is 16 bits on
+// AVR, so shifting it by 16 is undefined.
+static inline char sprite_byte(unsigned int c, char shift, char k)
+{
+    switch (k) {
+    case 0:
+        return c << shift;
+    case 1:
+        return c >> (8 - shift);
+    default:
+        return c >> (16 - shift);
+    }
+}
+
+// Draws sprite "image" from "atlas" with its top left at (x, y), in
+// pixels.
+static void fb_sprite(int x, int y, char const *atlas, char image, char mode)
+{
+    if (!clip_columns(x, SPRITE_SIZE)) {
+        return;
+    }
+
+    // The page the top is on, and the shift within it.
+    int page = y >> 3;
+    char shift = y & 0x07;
+    // Go over each of the pages it may cover that we're drawing. Only
+    // two if it's page-aligned.
+    char pages = shift ? 3 : 2;
+    for (char k = 0; k < pages; k++) {
+        char *row = fb_row(page + k);
+        if (row == NULL) {
+            continue;
+        }
+        char const *ptr = atlas + image * SPRITE_BYTES + clip_skip * 4;
+        char *dst = row + x + clip_skip;
+        for (int i = clip_count; i > 0; i--, dst++) {
+            unsigned int img = pgm_read_word(ptr);
+            unsigned int mask = pgm_read_word(ptr + 2);
+            ptr += 4;
+            char d = sprite_byte(img, shift, k);
+            switch (mode) {
+            case SPRITE_MASKED:
+                *dst = (*dst & ~sprite_byte(mask, shift, k)) | d;
+                break;
+            case SPRITE_OR:
+                *dst |= d;
+                break;
+            case SPRITE_XOR:
+                *dst ^= d;
+                break;
+            }
+        }
+    }
+}
+
+// Draws a frame's list of sprites, in order, so later ones are on top.
+MAYBE_UNUSED void fb_sprites(char const *atlas, struct sprite const *sprites,
+                             char count)
+{
+    for (; count > 0; count--, sprites++) {
+        fb_sprite(sprites->x, sprites->y, atlas, sprites->image,
+                  sprites->mode);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Tile map
+//
+// A console-style text mode, for screens that are a grid of
+// characters. The screen is kept as a 16x4 map of tiles, plus a bit per
+// tile saying it's changed since it was last sent. tile_flush sends
+// only the changed tiles, a run of neighbouring ones at a time. It's
+// as cheap to update as a framebuffer, in an eighth of the RAM.
+//
+// Tiles below 0x80 are ASCII. Those from 0x80 up are the glyphs of
+// the extended set, in order.
+//
+
+#define TILE_COLS (OLED_WIDTH / 8)
+#define TILE_ROWS OLED_PAGES
+#define TILE_EXTENDED 0x80
+
+static char tile_map[TILE_ROWS][TILE_COLS];
+// Bit x of tile_dirty[y] is set if tile (x, y) needs sending.
+static unsigned int tile_dirty[TILE_ROWS];
+
+// Returns the tile for a character, as from utf8_next.
+static char tile_char(unsigned int c)
+{
+    if (c < 0x80) {
+        return c;
+    }
+    int i = oled_extended_index(c);
+    return i < 0 ? '#' : TILE_EXTENDED + i;
+}
+
+// Returns the 8 columns of tile "t". "buf" holds those of extended
+// glyphs.
+static inline char const *tile_glyph(char t, char *buf)
+{
+    if (t >= TILE_EXTENDED) {
+        memcpy_P(buf, extended_glyphs + (t - TILE_EXTENDED) * 8, 8);
+        return buf;
+    }
+    char idx = (32 <= t) ? t - 32 : 3;
+    return charset + idx * 8;
+}
+
+// Source: the columns of a row of tiles.
+struct tile_src {
+    char const *tile;
+    char const *glyph;
+    char left;
+    char buf[8];
+};
+
+STREAM_INLINE void tile_src_init(struct tile_src *s, char const *tiles)
+{
+    s->tile = tiles;
+    s->left = 0;
+}
+
+STREAM_INLINE char tile_src_next(void *p)
+{
+    struct tile_src *s = p;
+    if (s->left == 0) {
+        s->glyph = tile_glyph(*s->tile++, s->buf);
+        s->left = 8;
+    }
+    s->left--;
+    return *s->glyph++;
+}
+
+// Sets tile (x, y), marking it dirty if it's changed.
+static void tile_set(int x, int y, char t)
+{
+    if (x < 0 || x >= TILE_COLS || y < 0 || y >= TILE_ROWS ||
+        tile_map[y][x] == t) {
+        return;
+    }
+    tile_map[y][x] = t;
+    tile_dirty[y] |= 1u << x;
+}
+
+// Writes a UTF-8 string into the map, starting at tile (x, y). Anything
+// off the end of the row is dropped.
+MAYBE_UNUSED void tile_write(int x, int y, char const *str)
+{
+    for (; *str != '\0' && x < TILE_COLS; x++) {
+        tile_set(x, y, tile_char(utf8_next(&str)));
+    }
+}
+
+// Marks every tile dirty, so the next flush redraws the whole screen,
+// e.g. after something else has drawn over it.
+static void tile_invalidate(void)
+{
+    for (int y = 0; y < TILE_ROWS; y++) {
+        // All TILE_COLS (16) bits. Shifting a 16-bit unsigned int by 16
+        // to make the mask would be undefined.
+        tile_dirty[y] = 0xffff;
+    }
+}
+
+// Fills the map with spaces, and marks it all dirty. Call this before
+// first using the map.
+MAYBE_UNUSED void tile_clear(void)
+{
+    memset(tile_map, ' ', sizeof(tile_map));
+    tile_invalidate();
+}
+
+// Sends the dirty tiles. A single clean tile between dirty ones is
+// sent too, as 8 bytes is less than the cost of starting another run.
+MAYBE_UNUSED void tile_flush(void)
+{
+    for (int y = 0; y < TILE_ROWS; y++) {
+        unsigned int dirty = tile_dirty[y];
+        int x = 0;
+        while (dirty != 0) {
+            // Find the start of the next run, then its end.
+            for (; !(dirty & 1); dirty >>= 1) {
+                x++;
+            }
+            int start = x;
+            for (; (dirty & 1) || (dirty & 3) == 2; dirty >>= 1) {
+                x++;
+            }
+
+            oled_set_page_mode(y, start * 8);
+            i2c_start(OLED_ADDR);
+            i2c_send_byte(OLED_DATA);
+            struct tile_src src;
+            tile_src_init(&src, &tile_map[y][start]);
+            bus_sink(&src, tile_src_next, (x - start) * 8);
+        }
+        tile_dirty[y] = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Delta frames
+//
+// A compact description of a frame by how it differs from the last,
+// for when only part of the screen changes. It's a sequence of ops,
+// working along the screen a page at a time from a starting position
+// (page * 128 + column). Each op is a byte with a count "n", from 1 to
+// 64, in its low six bits (stored as n - 1):
+//
+//   DELTA_SKIP | n          - Leave n bytes as they were
+//   DELTA_FILL | n, b       - n copies of b
+//   DELTA_LITERAL | n, ...  - n bytes as given
+//   DELTA_SEEK | hi, lo     - Move to position hi * 256 + lo
+//
+// What's unchanged is kept by not sending it, so decoding needs no
+// copy of the previous frame: each fill or literal goes straight to a
+// sink (clipped_bus_sink or fb_clipped_sink) as a span, pulled from
+// the ops as it's sent. See tools/src/delta.rs for the encoder.
+//
+
+#define DELTA_SKIP    0x00
+#define DELTA_FILL    0x40
+#define DELTA_LITERAL 0x80
+#define DELTA_SEEK    0xc0
+#define DELTA_OP_MASK 0xc0
+
+typedef void (*span_sink_fn)(void *, stream_next_fn, int, int, int);
+
+// Source: one byte, repeated.
+struct fill_src {
+    char c;
+};
+
+STREAM_INLINE char fill_src_next(void *p)
+{
+    struct fill_src *s = p;
+    return s->c;
+}
+
+// Sends "n" bytes from "src" to "sink" at "pos", split at page ends.
+STREAM_INLINE void delta_span(void *src, stream_next_fn next,
+                              span_sink_fn sink, int pos, int n)
+{
+    while (n > 0) {
+        int x = pos & (OLED_WIDTH - 1);
+        int count = OLED_WIDTH - x;
+        if (count > n) {
+            count = n;
+        }
+        sink(src, next, x, pos / OLED_WIDTH, count);
+        pos += count;
+        n -= count;
+    }
+}
+
+// Decodes "len" bytes of ops from "src", from position "pos". Doesn't
+// read past "len", however the ops are made up.
+STREAM_INLINE void delta_decode(void *src, stream_next_fn next,
+                                span_sink_fn sink, int pos, int len)
+{
+    while (len > 0) {
+        char op = next(src);
+        int n = (op & ~DELTA_OP_MASK) + 1;
+        len--;
+        switch (op & DELTA_OP_MASK) {
+        case DELTA_SKIP:
+            break;
+        case DELTA_FILL: {
+            if (len == 0) {
+                return;
+            }
+            struct fill_src fill = { next(src) };
+            len--;
+            delta_span(&fill, fill_src_next, sink, pos, n);
+            break;
+        }
+        case DELTA_LITERAL:
+            if (n > len) {
+                n = len;
+            }
+            len -= n;
+            delta_span(src, next, sink, pos, n);
+            break;
+        case DELTA_SEEK:
+            if (len == 0) {
+                return;
+            }
+            pos = ((op & ~DELTA_OP_MASK) << 8) | next(src);
+            len--;
+            continue;
+        }
+        pos += n;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Animation
+//
+// Plays delta-frame animations from flash, made by anim2teensy (see
+// tools/src/bin/anim2teensy.rs) from the GIFs in anims/. Each frame
+// is a header of the position its ops start from (with ANIM_KEY set
+// in the top byte for keyframes, which draw the whole screen) and the
+// length of its ops, both big-endian, followed by the ops. The first
+// frame is always a keyframe, so the animation can loop.
+//
+// The ops are pulled from flash as each span is sent, so playing needs
+// no RAM beyond a pointer and the schedule.
+//
+// Frames are paced by Timer1, running free at CPU clock / 64. Each is
+// due a period after the last, and its headroom is how long is left
+// once it's sent. If that's negative, the frame was late, and the
+// schedule restarts from then rather than rushing to catch up.
+//
+
+#define ANIM_KEY 0x80
+
+#define ANIM_TIMER_HZ (F_CPU / 64)
+
+struct anim {
+    char const *data;
+    int frames;
+    unsigned int period;
+    // The frame to play next, and its header.
+    int frame;
+    char const *next;
+    // When it's due, in Timer1 ticks.
+    unsigned int due;
+};
+
+// Sends the frame at "p" straight to the display, returning the next.
+static char const *anim_decode(char const *p)
+{
+    int pos = (pgm_read_byte(p) & ~ANIM_KEY) << 8 | pgm_read_byte(p + 1);
+    int len = pgm_read_byte(p + 2) << 8 | pgm_read_byte(p + 3);
+    struct flash_src src;
+    flash_src_init(&src, p + 4, len, 0);
+    delta_decode(&src, flash_src_next, clipped_bus_sink, pos, len);
+    return p + 4 + len;
+}
+
+// Starts an animation, with its first frame due now. Takes over Timer1.
+MAYBE_UNUSED void anim_start(struct anim *a, char const *data,
+                             int frames, int fps)
+{
+    a->data = data;
+    a->frames = frames;
+    a->period = ANIM_TIMER_HZ / fps;
+    a->frame = 0;
+    a->next = data;
+
+    TCCR1A = 0;
+    TIMSK1 = 0;
+    TCCR1B = (1 << CS11) | (1 << CS10);
+    a->due = TCNT1;
+}
+
+// Waits until the next frame's due, and sends it. Returns its headroom
+// in Timer1 ticks.
+MAYBE_UNUSED int anim_frame(struct anim *a)
+{
+    while ((int)(a->due - TCNT1) > 0) {
+    }
+    a->next = anim_decode(a->next);
+    if (++a->frame == a->frames) {
+        a->frame = 0;
+        a->next = a->data;
+    }
+
+    a->due += a->period;
+    int headroom = a->due - TCNT1;
+    if (headroom < 0) {
+        a->due = TCNT1;
+    }
+    return headroom;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Host link
+//
+// A host program (see tools/src/bin/hid2teensy.rs) can drive the
+// display over USB with these commands:
+//
+//   LINK_DATA, page, column, n, n bytes - Sent straight to the display
+//   LINK_TILES, first, n, n tiles       - Put in the tile map, from
+//                                         tile "first" (y * 16 + x)
+//   LINK_FLUSH, tag                     - Flushes the tile map, then
+//                                         replies LINK_FLUSH, tag
+//   LINK_DELTA, hi, lo, n, n bytes      - Delta frame ops, from position
+//                                         hi * 256 + lo
+//   LINK_I2C, addr, flags, n, n bytes   - Part of a raw I2C transaction
+//                                         (see "Bridge" below)
+//   LINK_STATS, tag                     - Replies LINK_STATS, tag, then
+//                                         the bridge's counters
+//
+// Over raw HID, each command is a 64-byte report. Each report is
+// copied out of the endpoint before it's handled, so the host can send
+// the next into the other half of the endpoint's double buffer while
+// we're busy on the I2C bus.
+//
+// With BULK_LINK, they can also come as a stream over the bulk
+// endpoint, with up to 255 bytes of data per command. Bulk packets
+// aren't limited to one per millisecond frame, and come a packet at a
+// time rather than a command at a time, so this gets many times the
+// bandwidth of raw HID. Again, each packet is copied out as soon as
+// we get to it, so the host can fill one bank while we empty the
+// other.
+//
+// An unknown command can't be skipped, as there's no telling how long
+// it is. Over raw HID the rest of its report is dropped anyway. Over
+// bulk the rest of its packet is dropped, and the stream starts again
+// with the next packet, so a host that's sent one should start its
+// next command on a packet boundary (a multiple of BULK_SIZE bytes).
+//
+// The replies to LINK_FLUSH let the host measure latency, and keep it
+// from getting too far ahead.
+//
+
+#define LINK_DATA  0x01
+#define LINK_TILES 0x02
+#define LINK_FLUSH 0x03
+#define LINK_DELTA 0x04
+#define LINK_I2C   0x05
+#define LINK_STATS 0x06
+
+// Bridge
+//
+// With LINK_I2C, the host can do its own rendering and drive the
+// display (or anything else on the bus) directly, with the firmware
+// just passing bytes through. Each command carries part of a
+// transaction: with LINK_I2C_START it begins one, sending the address
+// first, and with LINK_I2C_STOP it ends it, so a transaction can run
+// over as many commands as it needs. As in oled_sequence, a byte that
+// isn't acked ends the transaction, and the rest of it is dropped up
+// to the next start. Any other command ends an open transaction.
+//
+// As with the other commands, each packet has already been copied out
+// of the endpoint and its bank released by the time its bytes go out,
+// so the next packet arrives while this one's being sent. The counters
+// let the host check everything was acked, and work out throughput
+// over time.
+
+#define LINK_I2C_START 0x01
+#define LINK_I2C_STOP  0x02
+
+// Sent in reply to LINK_STATS as is: AVR is little-endian, and
+// doesn't pad structs.
+struct bridge_stats {
+    // Bytes acked, including addresses.
+    unsigned long bytes;
+    unsigned long transactions;
+    unsigned int nacks;
+};
+
+#ifdef HOST_LINK
+static struct bridge_stats bridge_stats;
+// Whether a transaction's been started, and everything since acked.
+static char bridge_open;
+
+static void bridge_end(void)
+{
+    i2c_stop();
+    bridge_open = 0;
+}
+
+// Sends "n" bytes from "src" as part of a transaction to "addr".
+STREAM_INLINE void bridge_command(void *src, stream_next_fn next,
+                                  char addr, char flags, int n)
+{
+    if (flags & LINK_I2C_START) {
+        if (bridge_open) {
+            bridge_end();
+        }
+        bridge_stats.transactions++;
+        bridge_open = 1;
+        if (i2c_start(addr)) {
+            bridge_stats.bytes++;
+        } else {
+            bridge_end();
+            bridge_stats.nacks++;
+        }
+    }
+    int acked = 0;
+    while (n > 0 && bridge_open) {
+        n--;
+        if (i2c_send_byte(next(src))) {
+            acked++;
+        } else {
+            bridge_end();
+            bridge_stats.nacks++;
+        }
+    }
+    stream_skip(src, next, n);
+    bridge_stats.bytes += acked;
+    if (bridge_open && (flags & LINK_I2C_STOP)) {
+        bridge_end();
+    }
+}
+
+// Handles a command read from "src", which has "len" bytes after the
+// command byte. If it needs more than that it's dropped. "reply" sends
+// "n" bytes of reply back over the same transport. Returns 0 if the
+// command's unknown, having read nothing past it.
+STREAM_INLINE char link_command(void *src, stream_next_fn next, int len,
+                                void (*reply)(char const *msg, char n))
+{
+    char command = next(src);
+    if (bridge_open && command != LINK_I2C) {
+        bridge_end();
+    }
+    switch (command) {
+    case LINK_DATA: {
+        char page = next(src);
+        char column = next(src);
+        int n = next(src);
+        if (n > len - 3) {
+            break;
+        }
+        clipped_bus_sink(src, next, column, page, n);
+        break;
+    }
+    case LINK_TILES: {
+        int first = next(src);
+        int n = next(src);
+        if (n > len - 2) {
+            break;
+        }
+        for (int t = first; t < first + n; t++) {
+            tile_set(t % TILE_COLS, t / TILE_COLS, next(src));
+        }
+        break;
+    }
+    case LINK_FLUSH: {
+        char msg[2] = { LINK_FLUSH, next(src) };
+        tile_flush();
+        reply(msg, sizeof(msg));
+        break;
+    }
+    case LINK_DELTA: {
+        int pos = next(src) << 8;
+        pos |= next(src);
+        int n = next(src);
+        if (n > len - 3) {
+            break;
+        }
+        delta_decode(src, next, clipped_bus_sink, pos, n);
+        break;
+    }
+    case LINK_I2C: {
+        char addr = next(src);
+        char flags = next(src);
+        int n = next(src);
+        if (n > len - 3) {
+            break;
+        }
+        bridge_command(src, next, addr, flags, n);
+        break;
+    }
+    case LINK_STATS: {
+        char msg[2 + sizeof(bridge_stats)] = { LINK_STATS, next(src) };
+        memcpy(msg + 2, &bridge_stats, sizeof(bridge_stats));
+        reply(msg, sizeof(msg));
+        break;
+    }
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+static void link_reply(char const *msg, char n)
+{
+    uint8_t reply[RAWHID_SIZE] = { 0 };
+    memcpy(reply, msg, n);
+    usb_rawhid_send(reply, 50);
+}
+
+// Handles any reports that have arrived.
+static void link_poll(void)
+{
+    uint8_t report[RAWHID_SIZE];
+    while (usb_rawhid_recv(report) > 0) {
+        struct ram_src src;
+        ram_src_init(&src, (char const *)report);
+        link_command(&src, ram_src_next, RAWHID_SIZE - 1, link_reply);
+    }
+}
+
+#ifdef BULK_LINK
+// Source: bytes from the bulk endpoint, a packet at a time, waiting
+// for each to arrive. A host that stops part way through a command
+// leaves us waiting.
+struct bulk_src {
+    uint8_t buf[BULK_SIZE];
+    char pos;
+    char len;
+};
+
+STREAM_INLINE char bulk_src_next(void *p)
+{
+    struct bulk_src *s = p;
+    while (s->pos == s->len) {
+        int8_t n = usb_bulk_read(s->buf, sizeof(s->buf));
+        s->pos = 0;
+        s->len = n > 0 ? n : 0;
+    }
+    return s->buf[(int)s->pos++];
+}
+
+// Commands can straddle packets, so this lasts between polls.
+static struct bulk_src bulk_in;
+
+static void bulk_reply(char const *msg, char n)
+{
+    usb_bulk_send((uint8_t const *)msg, n, 50);
+}
+
+// Handles the commands that have started to arrive.
+static void bulk_poll(void)
+{
+    while (bulk_in.pos < bulk_in.len || usb_bulk_available()) {
+        if (!link_command(&bulk_in, bulk_src_next, 3 + 255, bulk_reply)) {
+            // Its payload would be taken for commands, so drop the
+            // rest of the packet.
+            bulk_in.pos = bulk_in.len;
+        }
+    }
+}
+#endif // BULK_LINK
+#endif // HOST_LINK
+
+////////////////////////////////////////////////////////////////////////
+// Telemetry
+//
+
+// With TELEMETRY, the main demo sends a record over USB debug every
+// TELEMETRY_EVERY frames: how long they took, the cycles spent in each
+// oled_* call, the bus traffic and NACKs, and how much debug output is
+// queued and has been dropped. tools/src/bin/teensystat.rs shows them
+// as live stats and histograms.
+//
+// Records are LOGs (see log.h), so their layout is fixed by the
+// format, and teensylog can print them too. The format's "name=" before
+// each value is what teensystat calls it.
+//
+// Times come from Timer1, counting every cycle (see bench.c), so this
+// can't be combined with BENCHMARK or ANIM_DEMO. Each lap costs a
+// timer read, about 30 cycles, and each record about 400 cycles to
+// queue.
+
+// The calls timed in each frame.
+enum {
+    TELEMETRY_MARQUEE,
+    TELEMETRY_BUNGEE,
+    TELEMETRY_WOBBLE,
+    TELEMETRY_CALLS
+};
+
+#if defined(TELEMETRY) && (defined(BENCHMARK) || defined(ANIM_DEMO))
+#error "TELEMETRY needs Timer1, as do BENCHMARK and ANIM_DEMO"
+#endif
+
+#ifdef TELEMETRY
+#ifndef TELEMETRY_EVERY
+#define TELEMETRY_EVERY 1
+#endif
+
+struct telemetry {
+    // The frame being drawn, and how many since the last record.
+    unsigned long frame;
+    char frames;
+    // Cycle counts when the last record was sent, and at the end of
+    // the last lap.
+    unsigned long start;
+    unsigned long lap;
+    // Cycles spent in each call since the last record.
+    unsigned long cycles[TELEMETRY_CALLS];
+};
+
+static struct telemetry telemetry;
+
+// Takes over Timer1, and starts the first record.
+static void telemetry_start(void)
+{
+    bench_start();
+    memset(&telemetry, 0, sizeof(telemetry));
+}
+
+// Starts timing a frame's calls.
+static void telemetry_frame(void)
+{
+    telemetry.lap = bench_now();
+}
+
+// Adds the cycles since the last lap to those of "call".
+static void telemetry_lap(int call)
+{
+    unsigned long now = bench_now();
+    telemetry.cycles[call] += now - telemetry.lap;
+    telemetry.lap = now;
+}
+
+// Ends a frame, sending a record if it's the last of TELEMETRY_EVERY.
+static void telemetry_end_frame(void)
+{
+    telemetry.frames++;
+    if (telemetry.frames == TELEMETRY_EVERY) {
+        unsigned long now = bench_now();
+        LOG(TELEMETRY, "frame=%lu frames=%hhu cycles=%lu marquee=%lu "
+            "bungee=%lu wobble=%lu bytes=%u transactions=%u nacks=%u "
+            "queued=%hhu dropped=%u\n",
+            telemetry.frame, telemetry.frames, now - telemetry.start,
+            telemetry.cycles[TELEMETRY_MARQUEE],
+            telemetry.cycles[TELEMETRY_BUNGEE],
+            telemetry.cycles[TELEMETRY_WOBBLE],
+            i2c_bytes, i2c_transactions, i2c_nacks,
+            usb_debug_queued(), usb_debug_dropped());
+        telemetry.frames = 0;
+        telemetry.start = now;
+        memset(telemetry.cycles, 0, sizeof(telemetry.cycles));
+        i2c_bytes = 0;
+        i2c_transactions = 0;
+        i2c_nacks = 0;
+    }
+    telemetry.frame++;
+}
+#else
+static inline void telemetry_start(void) {}
+static inline void telemetry_frame(void) {}
+static inline void telemetry_lap(int call) {}
+static inline void telemetry_end_frame(void) {}
+#endif // TELEMETRY
+
+////////////////////////////////////////////////////////////////////////
+// And the main program itself...
+//
+
+// The messages themselves are in text/messages.txt, pre-rendered into
+// gen/messages.h.
+
+#if defined(BENCHMARK) || defined(SPRITE_DEMO)
+#define DEMO_SPRITES 8
+
+static struct sprite demo_sprites[DEMO_SPRITES];
+static signed char demo_dx[DEMO_SPRITES];
+static signed char demo_dy[DEMO_SPRITES];
+
+// Spread the sprites out, mostly masked, with one OR and one XOR.
+static void demo_sprites_init(void)
+{
+    for (int i = 0; i < DEMO_SPRITES; i++) {
+        demo_sprites[i].x = i * 14;
+        demo_sprites[i].y = (i * 5) & 0x0f;
+        demo_sprites[i].image = i % atlas_count;
+        demo_sprites[i].mode = i == 6 ? SPRITE_OR :
+                               i == 7 ? SPRITE_XOR : SPRITE_MASKED;
+        demo_dx[i] = (i & 1) ? 1 : -1;
+        demo_dy[i] = (i & 2) ? 1 : -1;
+    }
+}
+
+// Bounce the sprites off the edges of the screen.
+static void demo_sprites_move(void)
+{
+    for (int i = 0; i < DEMO_SPRITES; i++) {
+        struct sprite *s = &demo_sprites[i];
+        int x = s->x + demo_dx[i];
+        int y = s->y + demo_dy[i];
+        if (x < 0 || x > OLED_WIDTH - SPRITE_SIZE) {
+            demo_dx[i] = -demo_dx[i];
+        }
+        if (y < 0 || y > OLED_PAGES * 8 - SPRITE_SIZE) {
+            demo_dy[i] = -demo_dy[i];
+        }
+        s->x += demo_dx[i];
+        s->y += demo_dy[i];
+    }
+}
+
+// State of the text effects under the sprites.
+static int demo_offset;
+static uq8_8 demo_phase;
+
+// Move the text effects along.
+static void demo_effects_move(void)
+{
+    if (++demo_offset == message_1_cols_len) {
+        demo_offset = 0;
+    }
+    demo_phase += UQ8_8(1);
+}
+
+// A frame: the sprites over the head, heels and text effects.
+static void demo_sprites_scene(void)
+{
+    fb_blit(0, 0, 24, 3, head);
+    fb_blit(128 - 24, 0, 24, 3, heels);
+    fb_wobble_P((128 - message_3_cols_len) / 2, 0,
+                message_3_cols, message_3_cols_len,
+                cos_table_64_4, 4, demo_phase);
+    fb_marquee_P(0, 3, 128, message_1_cols, message_1_cols_len, demo_offset);
+    fb_sprites(atlas, demo_sprites, DEMO_SPRITES);
+}
+#endif // BENCHMARK || SPRITE_DEMO
+
+#ifdef SPRITE_DEMO
+// Runs flat out, so things move a pixel per frame, however long a
+// frame takes. Draws a page at a time, unless FULL_FRAMEBUFFER is
+// defined.
+static void sprite_demo(void)
+{
+    demo_sprites_init();
+    while (1) {
+#ifdef FULL_FRAMEBUFFER
+        fb_render(demo_sprites_scene);
+#else
+        page_render(demo_sprites_scene);
+#endif // FULL_FRAMEBUFFER
+        demo_sprites_move();
+        demo_effects_move();
+    }
+}
+#endif // SPRITE_DEMO
+
+#if defined(BENCHMARK) || defined(GREY_DEMO)
+// Where the ball is over the greyscale test image.
+static int grey_ball_x = 8;
+
+// The test image, with a ball over it.
+static void grey_scene(void)
+{
+    grey_blit_P(0, 0, OLED_WIDTH, OLED_PAGES, shades);
+    fb_fill_circle(grey_ball_x, 16, 6, grey_colour(GREY_DARK));
+    fb_circle(grey_ball_x, 16, 6, grey_colour(GREY_WHITE));
+}
+#endif // BENCHMARK || GREY_DEMO
+
+#ifdef GREY_DEMO
+// Shows the greyscale test image, moving the ball every few frames.
+static void grey_demo(void)
+{
+    int dx = 1;
+    grey_start();
+    while (1) {
+        grey_render(grey_scene);
+        for (int i = 0; i < 6; i++) {
+            grey_frame();
+        }
+        if (grey_ball_x + dx < 0 || grey_ball_x + dx >= OLED_WIDTH) {
+            dx = -dx;
+        }
+        grey_ball_x += dx;
+    }
+}
+#endif // GREY_DEMO
+
+#ifdef ANIM_DEMO
+// Plays anims/bounce.gif, logging each frame's headroom in cycles, or
+// how late it was.
+static void anim_demo(void)
+{
+    struct anim a;
+    anim_start(&a, bounce, bounce_frames, bounce_fps);
+    while (1) {
+        int frame = a.frame;
+        int headroom = anim_frame(&a);
+        // Negative when the frame was late.
+        LOG(ANIM_FRAME, "Frame %u: headroom %ld cycles\n",
+            frame, headroom * 64L);
+    }
+}
+#endif // ANIM_DEMO
+
+#ifdef HOST_LINK
+// Shows whatever the host sends, starting from a blank tile map.
+static void host_link(void)
+{
+    tile_clear();
+    tile_flush();
+    while (1) {
+        link_poll();
+#ifdef BULK_LINK
+        bulk_poll();
+#endif // BULK_LINK
+    }
+}
+#endif // HOST_LINK
+
+#ifdef BENCHMARK
+// Compare the cost of oled_number with formatting via avr-libc's
+// snprintf and then calling oled_write. Both send the same bytes to
+// the display, so the difference is the formatting overhead.
+static void benchmark_numbers(void)
+{
+    static const long values[] = { 0, 7, 1234, -98765, 99999 };
+    static const int num_values = sizeof(values) / sizeof(*values);
+    unsigned long cycles;
+
+    bench_start();
+    for (int i = 0; i < num_values; i++) {
+        oled_number(24, 2, 8, values[i], 2, " V");
+    }
+    cycles = bench_stop();
+    bench_print("oled_number", cycles);
+
+    bench_start();
+    for (int i = 0; i < num_values; i++) {
+        char buf[16];
+        long v = values[i];
+        snprintf_P(buf, sizeof(buf), PSTR("%5ld.%02ld V"),
+                   v / 100, labs(v % 100));
+        oled_write(24, 2, buf);
+    }
+    cycles = bench_stop();
+    bench_print("snprintf+oled_write", cycles);
+}
+
+// Time a frame of each demo effect, rendering the text at run time
+// and from pre-rendered columns.
+static void benchmark_effects(void)
+{
+    int offset;
+    uq8_8 phase;
+    unsigned long cycles;
+
+    offset = 0;
+    bench_start();
+    oled_marquee(24, 2 , 128 - 24 - 24, message_1, &offset, 2);
+    cycles = bench_stop();
+    bench_print("oled_marquee", cycles);
+
+    offset = 0;
+    bench_start();
+    oled_marquee_P(24, 2 , 128 - 24 - 24,
+                   message_1_cols, message_1_cols_len, &offset, 2);
+    cycles = bench_stop();
+    bench_print("oled_marquee_P", cycles);
+
+    offset = 0;
+    bench_start();
+    oled_bungee_marquee(0, 3, message_2, &offset);
+    cycles = bench_stop();
+    bench_print("oled_bungee_marquee", cycles);
+
+    offset = 0;
+    bench_start();
+    oled_bungee_marquee_P(0, 3, message_2_cols, message_2_cols_len, &offset);
+    cycles = bench_stop();
+    bench_print("oled_bungee_marquee_P", cycles);
+
+    phase = 0;
+    bench_start();
+    oled_wobble(36, 0, message_3, cos_table_64_4, 4, &phase, UQ8_8(1));
+    cycles = bench_stop();
+    bench_print("oled_wobble", cycles);
+
+    phase = 0;
+    bench_start();
+    oled_wobble_P(36, 0, message_3_cols, message_3_cols_len,
+                  cos_table_64_4, 4, &phase, UQ8_8(1));
+    cycles = bench_stop();
+    bench_print("oled_wobble_P", cycles);
+}
+
+// The previous oled_wobble_P, which makes a pass over the text for
+// each of its two pages, kept to compare against.
+static void oled_wobble_two_pass_P(int x, int y, char const *cols, int len,
+                                   char *phase)
+{
+    if (oled_start_clipped(x, y, len)) {
+        char shift = *phase + clip_skip;
+        char const *ptr = cols + clip_skip;
+        for (int i = clip_count; i > 0; i--) {
+            char offset = pgm_read_byte(&cos_table_64_4[shift++ & 0x3f]);
+            i2c_send_byte(pgm_read_byte(ptr++) << offset);
+        }
+        i2c_stop();
+    }
+
+    if (oled_start_clipped(x, y + 1, len)) {
+        char shift = *phase + clip_skip;
+        char const *ptr = cols + clip_skip;
+        for (int i = clip_count; i > 0; i--) {
+            char offset = 8 - pgm_read_byte(&cos_table_64_4[shift++ & 0x3f]);
+            i2c_send_byte(pgm_read_byte(ptr++) >> offset);
+        }
+        i2c_stop();
+    }
+
+    (*phase)++;
+}
+
+// Compare the two-pass and single-pass wobble, and time a wobble with
+// an amplitude bigger than a page.
+static void benchmark_wobble(void)
+{
+    char old_phase = 0;
+    uq8_8 phase;
+    unsigned long cycles;
+
+    bench_start();
+    oled_wobble_two_pass_P(36, 0, message_3_cols, message_3_cols_len,
+                           &old_phase);
+    cycles = bench_stop();
+    bench_print("oled_wobble_P, two pass", cycles);
+
+    phase = 0;
+    bench_start();
+    oled_wobble_P(36, 0, message_3_cols, message_3_cols_len,
+                  cos_table_64_4, 4, &phase, UQ8_8(1));
+    cycles = bench_stop();
+    bench_print("oled_wobble_P, single pass", cycles);
+
+    phase = UQ8_8(0.5);
+    bench_start();
+    oled_wobble_P(36, 0, message_3_cols, message_3_cols_len,
+                  cos_table_64_12, 12, &phase, UQ8_8(2.5));
+    cycles = bench_stop();
+    bench_print("oled_wobble_P, 4 pages, interpolated", cycles);
+}
+
+// The hand-written stretched marquee loop from before the column
+// stream pipeline, kept to compare against.
+static void oled_bungee_marquee_loop_P(int x, int y,
+                                       char const *cols, int len, int offset)
+{
+    if (!oled_start_clipped(x, y, 128)) {
+        return;
+    }
+    char const *map = colmap_bungee_128;
+    char const *ptr = cols + offset;
+    char const *end = cols + len;
+    for (int map_len = colmap_bungee_128_len; map_len > 0; map_len--) {
+        char c = pgm_read_byte(ptr++);
+        if (ptr == end) {
+            ptr = cols;
+        }
+        for (char j = pgm_read_byte(map++); j > 0; j--) {
+            if (clip_skip != 0) {
+                clip_skip--;
+            } else {
+                i2c_send_byte(c);
+                if (--clip_count == 0) {
+                    i2c_stop();
+                    return;
+                }
+            }
+        }
+    }
+    i2c_stop();
+}
+
+// Compare pipelines with hand-written loops, and an extra stage with
+// none.
+static void benchmark_pipeline(void)
+{
+    int offset = 0;
+    unsigned long cycles;
+
+    bench_start();
+    oled_bungee_marquee_loop_P(0, 3, message_2_cols, message_2_cols_len, 0);
+    cycles = bench_stop();
+    bench_print("bungee, hand-written loop", cycles);
+
+    bench_start();
+    oled_bungee_marquee_P(0, 3, message_2_cols, message_2_cols_len, &offset);
+    cycles = bench_stop();
+    bench_print("bungee, pipeline", cycles);
+
+    bench_start();
+    oled_write(0, 2, message_1);
+    cycles = bench_stop();
+    bench_print("oled_write", cycles);
+
+    bench_start();
+    oled_write_inverse(0, 2, message_1);
+    cycles = bench_stop();
+    bench_print("oled_write_inverse", cycles);
+}
+
+// Time a frame of the sprite demo drawn with a full framebuffer and a
+// page at a time, then 50 frames of each: under F_CPU cycles (0x7a1200
+// at 8MHz) is 50 fps or better.
+static void benchmark_sprites(void)
+{
+    unsigned long cycles;
+
+    demo_sprites_init();
+    bench_start();
+    fb_render(demo_sprites_scene);
+    cycles = bench_stop();
+    bench_print("sprite frame, framebuffer", cycles);
+
+    bench_start();
+    page_render(demo_sprites_scene);
+    cycles = bench_stop();
+    bench_print("sprite frame, page at a time", cycles);
+
+    bench_start();
+    for (int i = 0; i < 50; i++) {
+        fb_render(demo_sprites_scene);
+        demo_sprites_move();
+        demo_effects_move();
+    }
+    cycles = bench_stop();
+    bench_print("50 sprite frames, framebuffer", cycles);
+
+    bench_start();
+    for (int i = 0; i < 50; i++) {
+        page_render(demo_sprites_scene);
+        demo_sprites_move();
+        demo_effects_move();
+    }
+    cycles = bench_stop();
+    bench_print("50 sprite frames, page at a time", cycles);
+}
+
+// Compare redrawing a screen of text with oled_write and the tile map,
+// then updating a counter on it.
+static void benchmark_tiles(void)
+{
+    static char const *const lines[TILE_ROWS] = {
+        "Tile map test", "0123456789ABCDEF", "Temp: 21.5\xc2\xb0" "C", "Count:"
+    };
+    unsigned long cycles;
+
+    bench_start();
+    for (int y = 0; y < TILE_ROWS; y++) {
+        oled_write(0, y, lines[y]);
+    }
+    cycles = bench_stop();
+    bench_print("oled_write, screen of text", cycles);
+
+    tile_clear();
+    for (int y = 0; y < TILE_ROWS; y++) {
+        tile_write(0, y, lines[y]);
+    }
+    bench_start();
+    tile_flush();
+    cycles = bench_stop();
+    bench_print("tile_flush, screen of text", cycles);
+
+    bench_start();
+    for (int i = 0; i < 50; i++) {
+        char buf[8];
+        snprintf_P(buf, sizeof(buf), PSTR("%5d"), i * 37);
+        tile_write(7, 3, buf);
+        tile_flush();
+    }
+    cycles = bench_stop();
+    bench_print("50 counter updates, tile_flush", cycles);
+}
+
+// Time the transpose, and compare writing text natively with writing
+// it in a quarter turn.
+static void benchmark_rotation(void)
+{
+    char const *str = "Rot!";
+    char cell[8];
+    char rotation = oled_rotation;
+    unsigned long cycles;
+
+    bench_start();
+    for (int i = 0; i < 100; i++) {
+        bits_transpose(charset + i % 64 * 8, cell);
+    }
+    cycles = bench_stop();
+    bench_print("100 bits_transpose", cycles);
+
+    bench_start();
+    oled_write(0, 0, str);
+    cycles = bench_stop();
+    bench_print("oled_write, 4 chars", cycles);
+
+    oled_set_rotation(ROTATE_90);
+    bench_start();
+    oled_write_rotated(0, 0, str);
+    cycles = bench_stop();
+    bench_print("oled_write_rotated, 4 chars at 90", cycles);
+
+    oled_set_rotation(rotation);
+    oled_clear();
+}
+
+// Naive versions of the primitives, a pixel at a time, to compare
+// against.
+static void naive_fill_rect(int x, int y, int w, int h, char colour)
+{
+    for (int i = x; i < x + w; i++) {
+        for (int j = y; j < y + h; j++) {
+            fb_pixel(i, j, colour);
+        }
+    }
+}
+
+static void naive_line(int x0, int y0, int x1, int y1, char colour)
+{
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (1) {
+        fb_pixel(x0, y0, colour);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+static void naive_circle(int cx, int cy, int r, char colour)
+{
+    int d = 1 - r;
+    for (int x = 0, y = r; x <= y; x++) {
+        fb_pixel(cx + x, cy + y, colour);
+        fb_pixel(cx - x, cy + y, colour);
+        fb_pixel(cx + x, cy - y, colour);
+        fb_pixel(cx - x, cy - y, colour);
+        fb_pixel(cx + y, cy + x, colour);
+        fb_pixel(cx - y, cy + x, colour);
+        fb_pixel(cx + y, cy - x, colour);
+        fb_pixel(cx - y, cy - x, colour);
+        y = circle_step(x, y, &d);
+    }
+}
+
+static void naive_fill_circle(int cx, int cy, int r, char colour)
+{
+    int d = 1 - r;
+    for (int x = 0, y = r; x <= y; x++) {
+        naive_line(cx - x, cy - y, cx - x, cy + y, colour);
+        naive_line(cx + x, cy - y, cx + x, cy + y, colour);
+        naive_line(cx - y, cy - x, cx - y, cy + x, colour);
+        naive_line(cx + y, cy - x, cx + y, cy + x, colour);
+        y = circle_step(x, y, &d);
+    }
+}
+
+// A screen of primitives, drawn with the span-based functions.
+static void primitives_scene(void)
+{
+    fb_rect(0, 0, 128, 32, DRAW_SET);
+    fb_fill_rect(4, 4, 40, 24, DRAW_SET);
+    fb_fill_rect(8, 8, 32, 16, DRAW_CLEAR);
+    fb_line(48, 2, 80, 29, DRAW_SET);
+    fb_line(48, 29, 80, 2, DRAW_SET);
+    fb_line(2, 16, 125, 20, DRAW_INVERT);
+    fb_circle(100, 16, 13, DRAW_SET);
+    fb_fill_circle(100, 16, 8, DRAW_SET);
+}
+
+// The same, a pixel at a time.
+static void naive_scene(void)
+{
+    naive_line(0, 0, 127, 0, DRAW_SET);
+    naive_line(0, 31, 127, 31, DRAW_SET);
+    naive_line(0, 1, 0, 30, DRAW_SET);
+    naive_line(127, 1, 127, 30, DRAW_SET);
+    naive_fill_rect(4, 4, 40, 24, DRAW_SET);
+    naive_fill_rect(8, 8, 32, 16, DRAW_CLEAR);
+    naive_line(48, 2, 80, 29, DRAW_SET);
+    naive_line(48, 29, 80, 2, DRAW_SET);
+    naive_line(2, 16, 125, 20, DRAW_INVERT);
+    naive_circle(100, 16, 13, DRAW_SET);
+    naive_fill_circle(100, 16, 8, DRAW_SET);
+}
+
+// Time the scene with spans and a pixel at a time, with a full
+// framebuffer and a page at a time. Sending is the same for each, so
+// the difference is all drawing.
+static void benchmark_primitives(void)
+{
+    unsigned long cycles;
+
+    bench_start();
+    fb_render(primitives_scene);
+    cycles = bench_stop();
+    bench_print("fb_render, primitives", cycles);
+
+    bench_start();
+    fb_render(naive_scene);
+    cycles = bench_stop();
+    bench_print("fb_render, primitives, naive", cycles);
+
+    bench_start();
+    page_render(primitives_scene);
+    cycles = bench_stop();
+    bench_print("page_render, primitives", cycles);
+
+    bench_start();
+    page_render(naive_scene);
+    cycles = bench_stop();
+    bench_print("page_render, primitives, naive", cycles);
+}
+
+// Time 50 samples of a sine wave going into a sparkline and a bar
+// graph, with a label.
+static void benchmark_charts(void)
+{
+    static char spark_ring[96];
+    static char bar_ring[96];
+    struct chart spark = {
+        .x = 0, .y = 0, .w = 96, .h = 2, .style = CHART_SPARKLINE,
+        .lo = -127, .hi = 127, .ring = spark_ring, .label = 4,
+    };
+    struct chart bars = {
+        .x = 0, .y = 2, .w = 96, .h = 2, .style = CHART_BARS,
+        .lo = -127, .hi = 127, .ring = bar_ring,
+    };
+    unsigned long cycles;
+
+    oled_clear();
+    chart_init(&spark, 0);
+    chart_init(&bars, 0);
+
+    bench_start();
+    for (int i = 0; i < 50; i++) {
+        chart_push(&spark, (int8_t)pgm_read_byte(&sin_table_256_127[i * 8]));
+    }
+    cycles = bench_stop();
+    bench_print("50 sparkline samples", cycles);
+
+    bench_start();
+    for (int i = 0; i < 50; i++) {
+        chart_push(&bars, (int8_t)pgm_read_byte(&sin_table_256_127[i * 8]));
+    }
+    cycles = bench_stop();
+    bench_print("50 bar graph samples", cycles);
+}
+
+// Time drawing the greyscale test image, then 30 frames of it
+// against the time they're allowed, to see if the bus keeps up.
+static void benchmark_grey(void)
+{
+    unsigned long cycles;
+
+    grey_start();
+    bench_start();
+    grey_render(grey_scene);
+    cycles = bench_stop();
+    bench_print("grey_render", cycles);
+
+    bench_start();
+    for (int i = 0; i < 30; i++) {
+        grey_frame();
+    }
+    cycles = bench_stop();
+    bench_print("30 grey frames", cycles);
+    bench_print("30 grey frames, allowed", 30UL * GREY_FRAME_TICKS * 1024);
+
+    // And with the ball moving each frame, the worst case.
+    bench_start();
+    for (int i = 0; i < 30; i++) {
+        grey_ball_x++;
+        grey_render(grey_scene);
+        grey_frame();
+    }
+    cycles = bench_stop();
+    bench_print("30 grey frames, redrawn", cycles);
+    grey_stop();
+}
+
+// Compare a marquee row changing, sent as a delta frame and as a
+// plain page, then decoded into the buffer instead. Then clearing the
+// screen with fills.
+static void benchmark_delta(void)
+{
+    char ops[2 + 2 * (1 + 64)];
+    char clear[2 * OLED_PAGES * OLED_WIDTH / 64];
+    unsigned long cycles;
+
+    // Seek to the bottom page, then two literals of 64.
+    int pos = (OLED_PAGES - 1) * OLED_WIDTH;
+    ops[0] = DELTA_SEEK | (pos >> 8);
+    ops[1] = pos & 0xff;
+    for (int i = 0; i < 2; i++) {
+        ops[2 + i * 65] = DELTA_LITERAL | 63;
+        memcpy(ops + 3 + i * 65, charset + i * 64, 64);
+    }
+    for (int i = 0; i < (int)sizeof(clear); i += 2) {
+        clear[i] = DELTA_FILL | 63;
+        clear[i + 1] = 0;
+    }
+
+    struct ram_src src;
+    bench_start();
+    ram_src_init(&src, ops);
+    delta_decode(&src, ram_src_next, clipped_bus_sink, 0, sizeof(ops));
+    cycles = bench_stop();
+    bench_print("Delta, marquee row", cycles);
+
+    bench_start();
+    ram_src_init(&src, charset);
+    clipped_bus_sink(&src, ram_src_next, 0, OLED_PAGES - 1, OLED_WIDTH);
+    cycles = bench_stop();
+    bench_print("Plain, marquee row", cycles);
+
+    fb_buf = fb_screen;
+    fb_top = 0;
+    fb_bottom = OLED_PAGES;
+    bench_start();
+    ram_src_init(&src, ops);
+    delta_decode(&src, ram_src_next, fb_clipped_sink, 0, sizeof(ops));
+    fb_flush();
+    cycles = bench_stop();
+    bench_print("Delta into buffer, marquee row", cycles);
+
+    bench_start();
+    ram_src_init(&src, clear);
+    delta_decode(&src, ram_src_next, clipped_bus_sink, 0, sizeof(clear));
+    cycles = bench_stop();
+    bench_print("Delta, clear screen", cycles);
+}
+
+// Time a pass of the demo animation, sent as fast as possible, against
+// the time it's allowed, and its slowest frame.
+static void benchmark_anim(void)
+{
+    unsigned long cycles;
+    unsigned long slowest = 0;
+    char const *p = bounce;
+
+    unsigned long total = 0;
+    for (int i = 0; i < bounce_frames; i++) {
+        bench_start();
+        p = anim_decode(p);
+        cycles = bench_stop();
+        total += cycles;
+        if (cycles > slowest) {
+            slowest = cycles;
+        }
+    }
+    bench_print("Animation pass", total);
+    bench_print("Animation pass, allowed",
+                (unsigned long)bounce_frames * F_CPU / bounce_fps);
+    bench_print("Animation, slowest frame", slowest);
+}
+
+#ifdef MIRROR
+// The cost of mirroring, over a whole screen of data.
+static void benchmark_mirror(void)
+{
+    unsigned long cycles;
+
+    mirror_on = 0;
+    bench_start();
+    oled_clear();
+    cycles = bench_stop();
+    bench_print("oled_clear, not mirrored", cycles);
+
+    mirror_on = 1;
+    bench_start();
+    oled_clear();
+    cycles = bench_stop();
+    bench_print("oled_clear, mirrored", cycles);
+}
+#endif // MIRROR
+
+// Draw things fully on-screen, and then partly clipped. Only visible
+// columns are sent, so the clipped versions should cost in proportion.
+static void benchmark_clipping(void)
+{
+    int offset = 0;
+    unsigned long cycles;
+
+    bench_start();
+    oled_blit(0, 0, 24, 3, head);
+    cycles = bench_stop();
+    bench_print("oled_blit", cycles);
+
+    bench_start();
+    oled_blit(-12, 0, 24, 3, head);
+    cycles = bench_stop();
+    bench_print("oled_blit, half off-screen", cycles);
+
+    bench_start();
+    oled_write(64, 2, "Clipped!");
+    cycles = bench_stop();
+    bench_print("oled_write, half off-screen", cycles);
+
+    oled_set_clip(32, 0, 96, OLED_PAGES);
+    bench_start();
+    oled_bungee_marquee_P(0, 3, message_2_cols, message_2_cols_len, &offset);
+    cycles = bench_stop();
+    bench_print("oled_bungee_marquee_P, half clipped", cycles);
+    oled_reset_clip();
+}
+#endif // BENCHMARK
+
+int main(void)
+{
+    // CPU prescale must be set with interrupts disabled. They're off
+    // when the CPU starts.
+    //
+    // Don't forget to sync this with F_CPU in the Makefile.
+    cpu_prescale(CPU_8MHz);
+    led_init();
+    led_off();
+    i2c_init();
+
+    // Initialise USB for debug and the host link, but don't wait.
+    usb_init();
+#ifdef PROFILE
+    profile_start();
+#endif // PROFILE
+
+    // Wait for success init of the OLED.
+    while (!oled_init()) {
+        _delay_ms(20);
+    }
+#ifdef BENCHMARK
+    // Wait for the host to pick up debug output before reporting.
+    while (!usb_configured()) {
+    }
+    _delay_ms(1000);
+    benchmark_numbers();
+    benchmark_effects();
+    benchmark_clipping();
+    benchmark_wobble();
+    benchmark_pipeline();
+    benchmark_sprites();
+    benchmark_tiles();
+    benchmark_rotation();
+    benchmark_primitives();
+    benchmark_charts();
+    benchmark_grey();
+    benchmark_delta();
+    benchmark_anim();
+#ifdef MIRROR
+    benchmark_mirror();
+#endif // MIRROR
+    print("Debug bytes dropped: 0x");
+    phex16(usb_debug_dropped());
+    print("\n");
+    usb_debug_flush_output();
+#endif // BENCHMARK
+#ifdef SPRITE_DEMO
+    sprite_demo();
+#endif // SPRITE_DEMO
+#ifdef GREY_DEMO
+    grey_demo();
+#endif // GREY_DEMO
+#ifdef ANIM_DEMO
+    anim_demo();
+#endif // ANIM_DEMO
+#ifdef HOST_LINK
+    host_link();
+#endif // HOST_LINK
+
     // And then do the initial drawing.
     oled_clear();
     oled_blit(0, 0, 24, 3, head);
     oled_blit(128 - 24, 0, 24, 3, heels);
 
     // Find the x coordinate to centre message_3:
-    char m3_len = sizeof(message_3) - 1; // Remove NUL.
-    char m3_x = (128 - 8 * m3_len) / 2;
+    char m3_x = (128 - message_3_cols_len) / 2;
 
     int offset1 = 0;
     int offset2 = 0;
-    char phase = 0;
+    uq8_8 phase = 0;
 
     int contrast = 0;
 
+    telemetry_start();
     while (1) {
         _delay_ms(20);
 
@@ -557,8 +3829,17 @@ int main(void)
         oled_contrast(abs(contrast) + 30);
 #endif // DO_CONTRAST
 
-        oled_marquee(24, 2 , 128 - 24 - 24, message_1, &offset1, 2);
-        oled_bungee_marquee(0, 3 , 128, message_2, &offset2);
-        oled_wobble(m3_x, 0, message_3, &phase);
+        telemetry_frame();
+
+        oled_marquee_P(24, 2 , 128 - 24 - 24,
+                       message_1_cols, message_1_cols_len, &offset1, 2);
+        telemetry_lap(TELEMETRY_MARQUEE);
+        oled_bungee_marquee_P(0, 3,
+                              message_2_cols, message_2_cols_len, &offset2);
+        telemetry_lap(TELEMETRY_BUNGEE);
+        oled_wobble_P(m3_x, 0, message_3_cols, message_3_cols_len,
+                      cos_table_64_4, 4, &phase, UQ8_8(1));
+        telemetry_lap(TELEMETRY_WOBBLE);
+        telemetry_end_frame();
     }
 }
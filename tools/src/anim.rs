@@ -0,0 +1,517 @@
+//
+// Animations: loading frames from animated GIFs and PNGs, fitting them
+// to the display, and storing them as delta frames (see delta.rs),
+// either in flash for the firmware to play, or as a stream for
+// hid2teensy to send.
+//
+
+use std::fs::{self, File};
+use std::io::{BufWriter, Write};
+use std::path::Path;
+use std::thread;
+
+use crate::delta::{self, Op};
+use crate::{print_bytes, to_pages, Image};
+
+pub const WIDTH: u32 = 128;
+pub const HEIGHT: u32 = 32;
+
+// How long a frame with no delay of its own is shown, in milliseconds.
+pub const DEFAULT_DELAY_MS: u32 = 100;
+
+fn luma(r: u8, g: u8, b: u8) -> u8 {
+    ((r as u32 * 299 + g as u32 * 587 + b as u32 * 114) / 1000) as u8
+}
+
+////////////////////////////////////////////////////////////////////////
+// GIF
+//
+// Just enough of GIF89a to get animations out: global and local colour
+// tables, transparency, disposal and interlacing. Each frame is passed
+// to "each" as it's composited, with its delay.
+//
+
+fn u16_le(d: &[u8]) -> usize {
+    d[0] as usize | (d[1] as usize) << 8
+}
+
+// Undoes a GIF's variable-width LZW, giving "len" colour indices.
+fn lzw_decode(data: &[u8], min_size: u32, len: usize) -> Vec<u8> {
+    const MAX_CODES: usize = 4096;
+    let clear = 1usize << min_size;
+    let end = clear + 1;
+    // Each code's string is its prefix's string plus its suffix.
+    let mut prefix = vec![0u16; MAX_CODES];
+    let mut suffix = vec![0u8; MAX_CODES];
+    let mut first = vec![0u8; MAX_CODES];
+    let mut length = vec![0u16; MAX_CODES];
+    for c in 0..clear {
+        suffix[c] = c as u8;
+        first[c] = c as u8;
+        length[c] = 1;
+    }
+
+    let mut out = Vec::with_capacity(len);
+    let mut size = min_size + 1;
+    let mut next = end + 1;
+    let mut prev: Option<usize> = None;
+    let (mut bits, mut nbits, mut pos) = (0u32, 0u32, 0);
+    while out.len() < len {
+        while nbits < size && pos < data.len() {
+            bits |= (data[pos] as u32) << nbits;
+            nbits += 8;
+            pos += 1;
+        }
+        if nbits < size {
+            break;
+        }
+        let code = (bits & ((1 << size) - 1)) as usize;
+        bits >>= size;
+        nbits -= size;
+
+        if code == clear {
+            size = min_size + 1;
+            next = end + 1;
+            prev = None;
+            continue;
+        }
+        if code == end {
+            break;
+        }
+        match prev {
+            Some(p) if next < MAX_CODES => {
+                if code > next {
+                    break;
+                }
+                // A code can refer to the entry about to be added.
+                let c = if code == next { first[p] } else { first[code] };
+                prefix[next] = p as u16;
+                suffix[next] = c;
+                first[next] = first[p];
+                length[next] = length[p] + 1;
+                next += 1;
+                if next == 1 << size && size < 12 {
+                    size += 1;
+                }
+            }
+            None if code >= clear => break,
+            _ => (),
+        }
+        // Write the string backwards from its end.
+        let start = out.len();
+        out.resize(start + length[code] as usize, 0);
+        let mut c = code;
+        for i in (start..out.len()).rev() {
+            out[i] = suffix[c];
+            c = prefix[c] as usize;
+        }
+        prev = Some(code);
+    }
+    out.resize(len, 0);
+    out
+}
+
+// Reorders an interlaced image's rows.
+fn deinterlace(indices: &[u8], w: usize, h: usize) -> Vec<u8> {
+    let mut out = vec![0; w * h];
+    let mut src = 0;
+    for &(start, step) in [(0, 8), (4, 8), (2, 4), (1, 2)].iter() {
+        for y in (start..h).step_by(step) {
+            out[y * w..(y + 1) * w].copy_from_slice(&indices[src * w..(src + 1) * w]);
+            src += 1;
+        }
+    }
+    out
+}
+
+pub fn load_gif(file_name: &Path, mut each: impl FnMut(Image, u32)) {
+    let d = fs::read(file_name).unwrap();
+    assert!(d.starts_with(b"GIF87a") || d.starts_with(b"GIF89a"), "Not a GIF");
+    let (w, h) = (u16_le(&d[6..]), u16_le(&d[8..]));
+    let flags = d[10];
+    let mut p = 13;
+    let mut global = Vec::new();
+    if flags & 0x80 != 0 {
+        let n = 3 << ((flags & 7) + 1);
+        global = d[p..p + n].to_vec();
+        p += n;
+    }
+
+    let mut canvas = vec![0u8; w * h];
+    // From the graphic control extension, for the next image.
+    let (mut disposal, mut transparent, mut delay) = (0, None, 0);
+    loop {
+        match d[p] {
+            0x21 => {
+                if d[p + 1] == 0xf9 {
+                    let gce = &d[p + 3..];
+                    disposal = (gce[0] >> 2) & 7;
+                    transparent = if gce[0] & 1 != 0 { Some(gce[3]) } else { None };
+                    delay = u16_le(&gce[1..]) as u32 * 10;
+                }
+                p += 2;
+                while d[p] != 0 {
+                    p += 1 + d[p] as usize;
+                }
+                p += 1;
+            }
+            0x2c => {
+                let (left, top) = (u16_le(&d[p + 1..]), u16_le(&d[p + 3..]));
+                let (iw, ih) = (u16_le(&d[p + 5..]), u16_le(&d[p + 7..]));
+                let iflags = d[p + 9];
+                p += 10;
+                let mut table = &global[..];
+                if iflags & 0x80 != 0 {
+                    let n = 3 << ((iflags & 7) + 1);
+                    table = &d[p..p + n];
+                    p += n;
+                }
+                let min_size = d[p] as u32;
+                p += 1;
+                let mut data = Vec::new();
+                while d[p] != 0 {
+                    data.extend_from_slice(&d[p + 1..p + 1 + d[p] as usize]);
+                    p += 1 + d[p] as usize;
+                }
+                p += 1;
+
+                let mut indices = lzw_decode(&data, min_size, iw * ih);
+                if iflags & 0x40 != 0 {
+                    indices = deinterlace(&indices, iw, ih);
+                }
+                let saved = if disposal == 3 { Some(canvas.clone()) } else { None };
+                for y in 0..ih.min(h.saturating_sub(top)) {
+                    for x in 0..iw.min(w.saturating_sub(left)) {
+                        let i = indices[y * iw + x];
+                        if Some(i) != transparent && 3 * i as usize + 2 < table.len() {
+                            let c = &table[3 * i as usize..];
+                            canvas[(top + y) * w + left + x] = luma(c[0], c[1], c[2]);
+                        }
+                    }
+                }
+                let shown = if delay == 0 { DEFAULT_DELAY_MS } else { delay };
+                each(Image { width: w as u32, height: h as u32, pixels: canvas.clone() }, shown);
+
+                match (disposal, saved) {
+                    (2, _) => {
+                        for y in top..(top + ih).min(h) {
+                            for x in left..(left + iw).min(w) {
+                                canvas[y * w + x] = 0;
+                            }
+                        }
+                    }
+                    (3, Some(saved)) => canvas = saved,
+                    _ => (),
+                }
+                disposal = 0;
+                transparent = None;
+                delay = 0;
+            }
+            0x3b => return,
+            b => panic!("Bad GIF block: {:#x}", b),
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// PNG
+//
+// Single images, or the frames of an APNG. Each APNG frame simply
+// replaces its rectangle; blend and dispose ops are ignored.
+//
+
+pub fn load_apng(file_name: &Path, mut each: impl FnMut(Image, u32)) {
+    let decoder = png::Decoder::new(File::open(file_name).unwrap());
+    let (info, mut reader) = decoder.read_info().unwrap();
+    assert_eq!(info.bit_depth, png::BitDepth::Eight, "Only 8-bit PNGs");
+    let channels = match info.color_type {
+        png::ColorType::Grayscale => 1,
+        png::ColorType::GrayscaleAlpha => 2,
+        png::ColorType::RGB => 3,
+        png::ColorType::RGBA => 4,
+        _ => panic!("Unsupported PNG colour type"),
+    };
+    let (w, h) = (info.width as usize, info.height as usize);
+    let frames = reader.info().animation_control.as_ref().map_or(1, |a| a.num_frames);
+
+    let mut canvas = vec![0u8; w * h];
+    let mut buf = vec![0; info.buffer_size()];
+    for _ in 0..frames {
+        reader.next_frame(&mut buf).unwrap();
+        let (mut fx, mut fy, mut fw, mut fh) = (0, 0, w, h);
+        let mut delay = DEFAULT_DELAY_MS;
+        if let Some(fc) = reader.info().frame_control.as_ref() {
+            fx = fc.x_offset as usize;
+            fy = fc.y_offset as usize;
+            fw = fc.width as usize;
+            fh = fc.height as usize;
+            let den = if fc.delay_den == 0 { 100 } else { fc.delay_den as u32 };
+            if fc.delay_num != 0 {
+                delay = fc.delay_num as u32 * 1000 / den;
+            }
+        }
+        for y in 0..fh.min(h.saturating_sub(fy)) {
+            for x in 0..fw.min(w.saturating_sub(fx)) {
+                let c = &buf[(y * fw + x) * channels..];
+                canvas[(fy + y) * w + fx + x] = if channels >= 3 { luma(c[0], c[1], c[2]) } else { c[0] };
+            }
+        }
+        each(Image { width: w as u32, height: h as u32, pixels: canvas.clone() }, delay);
+    }
+}
+
+// Loads the frames of a GIF or PNG (animated or not), by extension.
+pub fn load_frames(file_name: &Path, each: impl FnMut(Image, u32)) {
+    match file_name.extension().and_then(|e| e.to_str()) {
+        Some("gif") | Some("GIF") => load_gif(file_name, each),
+        _ => load_apng(file_name, each),
+    }
+}
+
+// Which of "delays" (in milliseconds, each frame's time on screen) is
+// showing every 1/"fps" seconds, through to the end.
+pub fn resample(delays: &[u32], fps: u32) -> Vec<usize> {
+    let total: u64 = delays.iter().map(|&d| d as u64).sum();
+    let mut picks = Vec::new();
+    let (mut frame, mut frame_end) = (0, delays.first().map_or(0, |&d| d as u64));
+    let mut k = 0;
+    loop {
+        let t = k * 1000 / fps as u64;
+        if t >= total {
+            return picks;
+        }
+        while t >= frame_end {
+            frame += 1;
+            frame_end += delays[frame] as u64;
+        }
+        picks.push(frame);
+        k += 1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Fitting to the display
+//
+
+// For each pixel of an axis scaled from "src" to "dst" pixels, the
+// source pixels it covers and how much of each.
+fn axis_weights(src: usize, dst: usize) -> Vec<Vec<(usize, f32)>> {
+    let scale = src as f32 / dst as f32;
+    (0..dst)
+        .map(|i| {
+            let (lo, hi) = (i as f32 * scale, (i + 1) as f32 * scale);
+            let mut weights = Vec::new();
+            let mut s = lo.floor() as usize;
+            while (s as f32) < hi && s < src {
+                let cover = hi.min(s as f32 + 1.0) - lo.max(s as f32);
+                if cover > 0.0 {
+                    weights.push((s, cover / scale));
+                }
+                s += 1;
+            }
+            weights
+        })
+        .collect()
+}
+
+// Scales "image" to fit the display, keeping its shape, centred on
+// black, averaging the pixels each covers. Levels are 0 to 1.
+pub fn fit(image: &Image) -> Vec<f32> {
+    let (sw, sh) = (image.width as usize, image.height as usize);
+    let scale = (WIDTH as f32 / sw as f32).min(HEIGHT as f32 / sh as f32);
+    let dw = ((sw as f32 * scale).round() as usize).clamp(1, WIDTH as usize);
+    let dh = ((sh as f32 * scale).round() as usize).clamp(1, HEIGHT as usize);
+    let (ox, oy) = ((WIDTH as usize - dw) / 2, (HEIGHT as usize - dh) / 2);
+
+    // Across, then down.
+    let across = axis_weights(sw, dw);
+    let mut rows = vec![0.0f32; dw * sh];
+    for y in 0..sh {
+        let src = &image.pixels[y * sw..(y + 1) * sw];
+        for (x, weights) in across.iter().enumerate() {
+            rows[y * dw + x] = weights.iter().map(|&(s, k)| src[s] as f32 * k).sum::<f32>() / 255.0;
+        }
+    }
+    let mut out = vec![0.0f32; (WIDTH * HEIGHT) as usize];
+    for (y, weights) in axis_weights(sh, dh).iter().enumerate() {
+        for x in 0..dw {
+            let v = weights.iter().map(|&(s, k)| rows[s * dw + x] * k).sum();
+            out[(oy + y) * WIDTH as usize + ox + x] = v;
+        }
+    }
+    out
+}
+
+#[derive(Clone, Copy)]
+pub enum Dither {
+    // A fixed threshold pattern. Unchanged areas stay the same from
+    // frame to frame, which keeps deltas small and avoids shimmer.
+    Ordered,
+    // Floyd-Steinberg error diffusion. Better detail in stills, but
+    // any change ripples on across the frame.
+    Diffuse,
+}
+
+const BAYER_8: [[u8; 8]; 8] = [
+    [0, 32, 8, 40, 2, 34, 10, 42],
+    [48, 16, 56, 24, 50, 18, 58, 26],
+    [12, 44, 4, 36, 14, 46, 6, 38],
+    [60, 28, 52, 20, 62, 30, 54, 22],
+    [3, 35, 11, 43, 1, 33, 9, 41],
+    [51, 19, 59, 27, 49, 17, 57, 25],
+    [15, 47, 7, 39, 13, 45, 5, 37],
+    [63, 31, 55, 23, 61, 29, 53, 21],
+];
+
+// Dithers levels from "fit" to black and white, as an image.
+pub fn dither(levels: &[f32], how: Dither) -> Image {
+    let (w, h) = (WIDTH as usize, HEIGHT as usize);
+    let mut pixels = vec![0u8; w * h];
+    match how {
+        Dither::Ordered => {
+            for (i, &v) in levels.iter().enumerate() {
+                let t = (BAYER_8[i / w % 8][i % w % 8] as f32 + 0.5) / 64.0;
+                pixels[i] = if v > t { 0xff } else { 0x00 };
+            }
+        }
+        Dither::Diffuse => {
+            let mut err = levels.to_vec();
+            for y in 0..h {
+                for x in 0..w {
+                    let i = y * w + x;
+                    let on = err[i] > 0.5;
+                    pixels[i] = if on { 0xff } else { 0x00 };
+                    let e = err[i] - if on { 1.0 } else { 0.0 };
+                    for &(dx, dy, k) in [(1, 0, 7.0), (-1, 1, 3.0), (0, 1, 5.0), (1, 1, 1.0)].iter() {
+                        let (nx, ny) = (x as i32 + dx, y + dy);
+                        if nx >= 0 && (nx as usize) < w && ny < h {
+                            err[ny * w + nx as usize] += e * k / 16.0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    Image { width: WIDTH, height: HEIGHT, pixels }
+}
+
+// A frame as the display holds it: 512 bytes, a page at a time.
+pub fn to_frame(image: &Image) -> Vec<u8> {
+    to_pages(image).concat()
+}
+
+// Maps "f" over "items" using a thread per core, keeping the order.
+pub fn parallel_map<T: Sync, U: Send>(items: &[T], f: impl Fn(&T) -> U + Sync) -> Vec<U> {
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk = ((items.len() + threads - 1) / threads).max(1);
+    let f = &f;
+    thread::scope(|s| {
+        let handles: Vec<_> = items
+            .chunks(chunk)
+            .map(|c| s.spawn(move || c.iter().map(f).collect::<Vec<U>>()))
+            .collect();
+        handles.into_iter().flat_map(|h| h.join().unwrap()).collect()
+    })
+}
+
+////////////////////////////////////////////////////////////////////////
+// Delta-encoded animations
+//
+
+pub struct DeltaFrame {
+    // Drawn from scratch, rather than from the frame before.
+    pub key: bool,
+    pub pos: usize,
+    pub ops: Vec<u8>,
+}
+
+pub struct Animation {
+    pub fps: u32,
+    pub frames: Vec<DeltaFrame>,
+}
+
+impl Animation {
+    // Encodes "frames", each against the one before, apart from every
+    // "keyframe"th (and the first), in parallel.
+    pub fn encode(frames: &[Vec<u8>], fps: u32, keyframe: usize) -> Animation {
+        let indices: Vec<usize> = (0..frames.len()).collect();
+        let frames = parallel_map(&indices, |&i| {
+            let key = i == 0 || (keyframe != 0 && i % keyframe == 0);
+            let prev = if key { None } else { Some(&frames[i - 1][..]) };
+            let (pos, ops) = delta::encode(prev, &frames[i]);
+            DeltaFrame { key, pos, ops: ops.into_iter().flat_map(|op| op.bytes).collect() }
+        });
+        Animation { fps, frames }
+    }
+
+    pub fn ops(&self, frame: usize) -> Vec<Op> {
+        let f = &self.frames[frame];
+        delta::parse(f.pos, &f.ops)
+    }
+
+    pub fn size(&self) -> usize {
+        self.frames.iter().map(|f| 4 + f.ops.len()).sum()
+    }
+
+    // As a C array for flash. Each frame is a header of position (top
+    // bit set for keyframes) and op length, both big-endian 16 bits,
+    // then the ops.
+    pub fn write_c(&self, name: &str) {
+        println!(
+            "// {} frames at {} frames/s, {} bytes ({:.1}% of raw)",
+            self.frames.len(),
+            self.fps,
+            self.size(),
+            100.0 * self.size() as f64 / (512 * self.frames.len()) as f64
+        );
+        println!("static const char {}[] PROGMEM = {{", name);
+        for (i, f) in self.frames.iter().enumerate() {
+            println!("    // Frame {}{}", i, if f.key { " (key)" } else { "" });
+            let pos = f.pos | if f.key { 0x8000 } else { 0 };
+            print_bytes(&[(pos >> 8) as u8, pos as u8, (f.ops.len() >> 8) as u8, f.ops.len() as u8]);
+            println!();
+            for chunk in f.ops.chunks(16) {
+                print_bytes(chunk);
+                println!();
+            }
+        }
+        println!("}};");
+        println!("static const int {}_frames = {};", name, self.frames.len());
+        println!("static const int {}_fps = {};", name, self.fps);
+    }
+
+    // As a stream for hid2teensy: STREAM_MAGIC, frames per second, then
+    // the frames as in write_c but little-endian.
+    pub fn write_stream(&self, file_name: &Path) {
+        let mut out = BufWriter::new(File::create(file_name).unwrap());
+        out.write_all(STREAM_MAGIC).unwrap();
+        out.write_all(&[self.fps as u8]).unwrap();
+        for f in self.frames.iter() {
+            let pos = f.pos | if f.key { 0x8000 } else { 0 };
+            out.write_all(&(pos as u16).to_le_bytes()).unwrap();
+            out.write_all(&(f.ops.len() as u16).to_le_bytes()).unwrap();
+            out.write_all(&f.ops).unwrap();
+        }
+    }
+
+    pub fn read_stream(file_name: &Path) -> Animation {
+        let d = fs::read(file_name).unwrap();
+        assert!(d.starts_with(STREAM_MAGIC), "Not an animation stream");
+        let fps = d[STREAM_MAGIC.len()] as u32;
+        let mut frames = Vec::new();
+        let mut p = STREAM_MAGIC.len() + 1;
+        while p < d.len() {
+            let pos = u16_le(&d[p..]);
+            let len = u16_le(&d[p + 2..]);
+            frames.push(DeltaFrame {
+                key: pos & 0x8000 != 0,
+                pos: pos & 0x7fff,
+                ops: d[p + 4..p + 4 + len].to_vec(),
+            });
+            p += 4 + len;
+        }
+        Animation { fps, frames }
+    }
+}
+
+const STREAM_MAGIC: &[u8] = b"OLEDANIM";
@@ -0,0 +1,92 @@
+//
+// anim2teensy: Convert an animation into delta frames, for the
+// firmware to play from flash or for hid2teensy to stream.
+//
+// The input is an animated GIF or PNG, or a sequence of images (GIF or
+// PNG, of any size and colour) shown one after another. Each frame is
+// scaled to fit the display, dithered to black and white, and encoded
+// as the changes from the frame before (see delta.rs), with the work
+// spread across all cores.
+//
+// Usage: anim2teensy [options] <animation> | <image>...
+//
+// Options:
+//   --fps N       Frames per second to resample to (default 20).
+//   --seq-fps N   Frames per second of an image sequence (default 10).
+//   --keyframe N  Draw every Nth frame from scratch (default only the
+//                 first), so playback can start from it.
+//   --diffuse     Error-diffusion dithering, rather than ordered.
+//   --stream F    Write a stream to F for "hid2teensy stream", rather
+//                 than printing a C array.
+//   --name N      Name of the C array (default from the first file).
+//
+
+use std::env;
+use std::path::Path;
+
+use image2teensy::anim::{dither, fit, load_frames, parallel_map, resample, to_frame, Animation, Dither};
+use image2teensy::Image;
+
+fn main() {
+    let mut args: Vec<String> = env::args().skip(1).collect();
+    let mut option = |name: &str| match args.iter().position(|a| a == name) {
+        Some(i) => {
+            let value = args.get(i + 1).cloned().expect("Missing option value");
+            args.drain(i..i + 2);
+            Some(value)
+        }
+        None => None,
+    };
+    let fps: u32 = option("--fps").map_or(20, |v| v.parse().expect("Bad --fps"));
+    let seq_fps: u32 = option("--seq-fps").map_or(10, |v| v.parse().expect("Bad --seq-fps"));
+    let keyframe: usize = option("--keyframe").map_or(0, |v| v.parse().expect("Bad --keyframe"));
+    let stream = option("--stream");
+    let name = option("--name");
+    let how = match args.iter().position(|a| a == "--diffuse") {
+        Some(i) => {
+            args.remove(i);
+            Dither::Diffuse
+        }
+        None => Dither::Ordered,
+    };
+    assert!(!args.is_empty(), "Usage: anim2teensy [options] <animation> | <image>...");
+    assert!(0 < fps && fps < 256, "Bad --fps");
+
+    // Every file's frames, one after another. Single images in a
+    // sequence get the sequence's rate.
+    let mut images: Vec<Image> = Vec::new();
+    let mut delays: Vec<u32> = Vec::new();
+    for file_name in args.iter() {
+        let first = images.len();
+        load_frames(Path::new(file_name), |image, delay| {
+            images.push(image);
+            delays.push(delay);
+        });
+        if args.len() > 1 && images.len() == first + 1 {
+            delays[first] = 1000 / seq_fps;
+        }
+    }
+
+    let picks = resample(&delays, fps);
+    let frames = parallel_map(&picks, |&i| to_frame(&dither(&fit(&images[i]), how)));
+    let anim = Animation::encode(&frames, fps, keyframe);
+    eprintln!(
+        "{} source frames, {} at {} frames/s, {} bytes ({:.0} bytes/frame)",
+        images.len(),
+        frames.len(),
+        fps,
+        anim.size(),
+        anim.size() as f64 / frames.len() as f64
+    );
+
+    match stream {
+        Some(file_name) => anim.write_stream(Path::new(&file_name)),
+        None => {
+            let name = name.unwrap_or_else(|| {
+                let stem = Path::new(&args[0]).file_stem().unwrap().to_str().unwrap();
+                stem.replace(|c: char| !c.is_ascii_alphanumeric(), "_")
+            });
+            anim.write_c(&name);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+//
+// colmap2teensy: Generate column maps, which stretch a run of source
+// columns horizontally across the display with a varying scale. Each
+// entry is the number of times to repeat the next source column (0
+// skips it), and the entries add up to the output width, so drawing is
+// just streaming the map with no per-frame arithmetic.
+//
+// Usage: colmap2teensy <profile>:<width>...
+//
+// Profiles:
+//   bungee  - The original bungee marquee scaling.
+//   fisheye - Magnified in the middle, 4x at the centre.
+//   sine    - Two bulges, magnified 4x at a quarter and three quarters.
+//   ease    - Ease in/out: magnified 4x at the edges, 1x in the middle.
+//
+
+use std::env;
+use std::f64::consts::PI;
+
+// The bungee marquee's original scaling: the scale goes up by one for
+// each source column before the midpoint and down after, and each
+// column is repeated 1 + scale / 8 times.
+fn bungee(width: usize) -> Vec<u8> {
+    let midpoint = width / 2;
+    let mut scale: i32 = 0;
+    let mut left = width;
+    let mut runs = Vec::new();
+    while left > 0 {
+        let run = std::cmp::min(1 + (scale / 8) as usize, left);
+        runs.push(run as u8);
+        left -= run;
+        scale += if left > midpoint { 1 } else { -1 };
+        if scale < 0 {
+            scale = 0;
+        }
+    }
+    runs
+}
+
+// Build a map from a magnification function over [0, 1), by stepping
+// through the source at 1 / magnification per output column.
+fn from_magnification(width: usize, mag: impl Fn(f64) -> f64) -> Vec<u8> {
+    let mut runs: Vec<u8> = vec![0];
+    let mut src = 0.0;
+    for x in 0..width {
+        let u = (x as f64 + 0.5) / width as f64;
+        let col = src as usize;
+        while runs.len() <= col {
+            runs.push(0);
+        }
+        runs[col] += 1;
+        src += 1.0 / mag(u);
+    }
+    runs
+}
+
+fn profile(name: &str, width: usize) -> Vec<u8> {
+    match name {
+        "bungee" => bungee(width),
+        "fisheye" => from_magnification(width, |u| {
+            let d = 2.0 * u - 1.0;
+            1.0 + 3.0 * (1.0 - d * d).powi(2)
+        }),
+        "sine" => from_magnification(width, |u| 1.0 + 1.5 * (1.0 - (4.0 * PI * u).cos())),
+        "ease" => from_magnification(width, |u| 1.0 + 3.0 * (2.0 * u - 1.0).powi(4)),
+        _ => panic!("Unknown profile: {}", name),
+    }
+}
+
+fn main() {
+    for arg in env::args().skip(1) {
+        let mut parts = arg.split(':');
+        let name = parts.next().unwrap();
+        let width: usize = parts.next().expect("Missing width").parse().unwrap();
+        assert!(width <= 128);
+
+        let runs = profile(name, width);
+        assert_eq!(runs.iter().map(|&r| r as usize).sum::<usize>(), width);
+
+        let ident = format!("colmap_{}_{}", name, width);
+        println!("static const char {}[] PROGMEM = {{", ident);
+        for chunk in runs.chunks(16) {
+            print!("    ");
+            for r in chunk {
+                print!("{}, ", r);
+            }
+            println!();
+        }
+        println!("}};");
+        println!("static const int {}_len = {};", ident, runs.len());
+        println!();
+    }
+}
@@ -0,0 +1,42 @@
+//
+// font2teensy: Convert an image of extra (non-ASCII) characters into a
+// sparse glyph set for flash, indexed by a table of code points sorted
+// so the display code can binary search it.
+//
+// Usage: font2teensy <font.png> <font.txt>
+//
+// The text file lists the characters in the image, in order.
+//
+
+use std::env;
+use std::path::Path;
+
+use image2teensy::{load_extended_font, print_bytes};
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    assert_eq!(args.len(), 3);
+    let font = load_extended_font(Path::new(&args[1]), Path::new(&args[2]));
+    let stem = Path::new(&args[1]).file_stem().unwrap().to_str().unwrap();
+
+    for (c, _) in font.iter() {
+        assert!((*c as u32) < 0x10000, "Only the BMP is supported: {:?}", c);
+    }
+
+    println!("#include <avr/pgmspace.h>");
+    println!();
+    println!("static const unsigned int {}_codes[] PROGMEM = {{", stem);
+    for (c, _) in font.iter() {
+        println!("    0x{:04x}, // {:?}", *c as u32, c);
+    }
+    println!("}};");
+    println!();
+    println!("static const char {}_glyphs[] PROGMEM = {{", stem);
+    for (c, glyph) in font.iter() {
+        print_bytes(glyph);
+        println!("// {:?}", c);
+    }
+    println!("}};");
+    println!();
+    println!("static const int {}_count = {};", stem, font.iter().count());
+}
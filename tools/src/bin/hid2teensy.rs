@@ -0,0 +1,352 @@
+//
+// hid2teensy: Drive the display over the host link, with the
+// firmware built with HOST_LINK.
+//
+// Usage: hid2teensy [--emulate] [--bulk] image <image.png>
+//        hid2teensy [--emulate] [--bulk] play <image.png>...
+//        hid2teensy [--emulate] [--bulk] stream <anim.stream>
+//        hid2teensy [--emulate] [--bulk] text <line>...
+//        hid2teensy [--emulate] [--bulk] bridge <image.png>
+//        hid2teensy [--emulate] [--bulk] bench
+//
+// "image" sends a 128x32 image straight to the display, "play" sends
+// a sequence of them as delta frames, "stream" plays a stream from
+// anim2teensy at its frame rate, "text" puts up to four lines of
+// text in the tile map, "bridge" sends an image as raw I2C
+// transactions through the bridge and reports its counters, and
+// "bench" measures how fast data gets
+// through the link (sent off the bottom of the display, so the
+// firmware drops it), how fast whole frames get to the display, how
+// much delta frames help when only a marquee row changes, and how long
+// a small update takes to come back, and how fast the bridge passes
+// whole frames through.
+//
+// With --bulk, it uses the bulk interface (firmware built with
+// BULK_LINK) rather than raw HID. With --emulate, it talks to a
+// stand-in for the firmware (see link.rs) rather than a real Teensy,
+// which only makes sense for "bench".
+//
+
+use std::env;
+use std::path::Path;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use image2teensy::anim::Animation;
+use image2teensy::link::{
+    data_commands, delta_commands, flush_command, i2c_commands, ops_commands, stats_command,
+    tile_commands, BridgeStats, Bulk, Emulated, Hidraw, Link, BULK, HID, LINK_FLUSH, LINK_STATS,
+    TILE_COLS,
+};
+use image2teensy::{load_png, to_pages};
+
+const WIDTH: usize = 128;
+const PAGES: usize = 4;
+
+// Roughly how long the firmware takes to read a byte from the
+// endpoint and handle it, and to send one over its bit-banged I2C.
+const EMULATED_READ_TIME: Duration = Duration::from_nanos(1000);
+const EMULATED_BYTE_TIME: Duration = Duration::from_micros(25);
+
+const BENCH_LINK_FRAMES: usize = 500;
+const BENCH_FRAMES: usize = 100;
+const BENCH_ROUND_TRIPS: usize = 200;
+
+// For the bridge: the display's address and control bytes, and the
+// commands to address the whole screen horizontally, so a frame is
+// one run of data.
+const OLED_ADDR: u8 = 0x78;
+const OLED_CMD: u8 = 0x00;
+const OLED_DATA: u8 = 0x40;
+const OLED_WHOLE_SCREEN: [u8; 8] = [0x20, 0x00, 0x21, 0x00, 0x7f, 0x22, 0x00, 0x03];
+
+// Waits for the reply of kind "kind" with tag "tag".
+fn wait_reply(link: &mut dyn Link, kind: u8, tag: u8) -> Vec<u8> {
+    loop {
+        let reply = link.recv();
+        if reply[0] == kind && reply[1] == tag {
+            return reply;
+        }
+    }
+}
+
+// Flushes the tile map, and waits for the firmware to say it's done.
+fn flush(link: &mut dyn Link, tag: u8) {
+    link.send(&flush_command(tag));
+    wait_reply(link, LINK_FLUSH, tag);
+}
+
+// Gets the bridge's counters, once everything before has been handled.
+fn stats(link: &mut dyn Link, tag: u8) -> BridgeStats {
+    link.send(&stats_command(tag));
+    BridgeStats::from_reply(&wait_reply(link, LINK_STATS, tag))
+}
+
+// Commands for the bridge to address the whole screen, and send
+// "frame" to it.
+fn bridge_commands(frame: &[u8], command_len: usize) -> Vec<Vec<u8>> {
+    let setup = [&[OLED_CMD][..], &OLED_WHOLE_SCREEN].concat();
+    let mut commands = i2c_commands(OLED_ADDR, &setup, command_len);
+    commands.extend(i2c_commands(OLED_ADDR, &[&[OLED_DATA][..], frame].concat(), command_len));
+    commands
+}
+
+fn send_image(link: &mut dyn Link, file_name: &Path) {
+    let image = load_png(file_name);
+    assert_eq!(image.width as usize, WIDTH);
+    assert_eq!(image.height as usize, PAGES * 8);
+    for command in data_commands(0, &to_pages(&image), link.command_len()).iter() {
+        link.send(command);
+    }
+    // Nothing to flush, but it means everything's arrived.
+    flush(link, 0);
+}
+
+// Sends a frame a page at a time, as the display holds it, as the
+// changes from "prev".
+fn send_delta(link: &mut dyn Link, prev: Option<&[u8]>, frame: &[u8]) -> usize {
+    let commands = delta_commands(prev, frame, link.command_len());
+    for command in commands.iter() {
+        link.send(command);
+    }
+    commands.iter().map(|c| c.len()).sum()
+}
+
+fn play(link: &mut dyn Link, file_names: &[String]) {
+    let mut prev: Option<Vec<u8>> = None;
+    let mut total = 0;
+    let start = Instant::now();
+    for (i, file_name) in file_names.iter().enumerate() {
+        let image = load_png(Path::new(file_name));
+        assert_eq!(image.width as usize, WIDTH);
+        assert_eq!(image.height as usize, PAGES * 8);
+        let frame = to_pages(&image).concat();
+        total += send_delta(link, prev.as_deref(), &frame);
+        flush(link, i as u8);
+        prev = Some(frame);
+    }
+    let secs = start.elapsed().as_secs_f64();
+    println!(
+        "{} frames in {:.3}s, {:.1} frames/s, {:.0} bytes/frame",
+        file_names.len(),
+        secs,
+        file_names.len() as f64 / secs,
+        total as f64 / file_names.len() as f64
+    );
+}
+
+// Plays an anim2teensy stream, a frame each 1/fps seconds, counting
+// frames that arrive late.
+fn stream(link: &mut dyn Link, file_name: &Path) {
+    let anim = Animation::read_stream(file_name);
+    let period = Duration::from_secs(1) / anim.fps;
+    let mut late = 0;
+    let start = Instant::now();
+    for i in 0..anim.frames.len() {
+        for command in ops_commands(&anim.ops(i), link.command_len()).iter() {
+            link.send(command);
+        }
+        flush(link, i as u8);
+        let due = start + period * (i as u32 + 1);
+        match due.checked_duration_since(Instant::now()) {
+            Some(wait) => thread::sleep(wait),
+            None => late += 1,
+        }
+    }
+    println!(
+        "{} frames in {:.3}s at {} frames/s, {} late, {} bytes",
+        anim.frames.len(),
+        start.elapsed().as_secs_f64(),
+        anim.fps,
+        late,
+        anim.size()
+    );
+}
+
+fn send_bridge(link: &mut dyn Link, file_name: &Path) {
+    let image = load_png(file_name);
+    assert_eq!(image.width as usize, WIDTH);
+    assert_eq!(image.height as usize, PAGES * 8);
+    let before = stats(link, 0);
+    for command in bridge_commands(&to_pages(&image).concat(), link.command_len()).iter() {
+        link.send(command);
+    }
+    let counts = stats(link, 1).since(&before);
+    println!(
+        "{} bytes acked in {} transactions, {} not acked",
+        counts.bytes, counts.transactions, counts.nacks
+    );
+}
+
+fn send_text(link: &mut dyn Link, lines: &[String]) {
+    assert!(lines.len() <= PAGES, "At most {} lines", PAGES);
+    let mut tiles = vec![b' '; PAGES * TILE_COLS];
+    for (row, line) in lines.iter().enumerate() {
+        for (col, c) in line.bytes().take(TILE_COLS).enumerate() {
+            tiles[row * TILE_COLS + col] = c;
+        }
+    }
+    for command in tile_commands(0, &tiles, link.command_len()).iter() {
+        link.send(command);
+    }
+    flush(link, 0);
+}
+
+// Sends "frames" copies of "pages" from "first_page" down, back to
+// back, with one flush at the end so the time covers them all
+// arriving, and prints the rate.
+fn bench_frames(
+    link: &mut dyn Link,
+    what: &str,
+    first_page: usize,
+    pages: &[Vec<u8>],
+    frames: usize,
+) {
+    let commands = data_commands(first_page, pages, link.command_len());
+    let start = Instant::now();
+    for _ in 0..frames {
+        for command in commands.iter() {
+            link.send(command);
+        }
+    }
+    flush(link, 0);
+    let secs = start.elapsed().as_secs_f64();
+    println!(
+        "{}: {} frames in {:.3}s, {:.1} frames/s, {:.0} bytes/s ({} commands/frame)",
+        what,
+        frames,
+        secs,
+        frames as f64 / secs,
+        (frames * PAGES * WIDTH) as f64 / secs,
+        commands.len()
+    );
+}
+
+// A marquee scrolling along the bottom page of "frame", sent as whole
+// frames and as delta frames.
+fn bench_marquee(link: &mut dyn Link, frame: &[Vec<u8>]) {
+    let frames: Vec<Vec<u8>> = (0..BENCH_FRAMES)
+        .map(|i| {
+            let mut pages = frame.to_vec();
+            pages[PAGES - 1].rotate_left(i % WIDTH);
+            pages.concat()
+        })
+        .collect();
+
+    for &delta in [false, true].iter() {
+        let mut bytes = 0;
+        let start = Instant::now();
+        for (i, frame) in frames.iter().enumerate() {
+            if delta {
+                let prev = if i == 0 { None } else { Some(&frames[i - 1][..]) };
+                bytes += send_delta(link, prev, frame);
+            } else {
+                let pages: Vec<Vec<u8>> = frame.chunks(WIDTH).map(|p| p.to_vec()).collect();
+                for command in data_commands(0, &pages, link.command_len()).iter() {
+                    bytes += command.len();
+                    link.send(command);
+                }
+            }
+        }
+        flush(link, 0);
+        let secs = start.elapsed().as_secs_f64();
+        println!(
+            "Marquee, {}: {} frames in {:.3}s, {:.1} frames/s, {:.0} bytes/frame",
+            if delta { "delta" } else { "whole" },
+            frames.len(),
+            secs,
+            frames.len() as f64 / secs,
+            bytes as f64 / frames.len() as f64
+        );
+    }
+}
+
+// Whole frames through the bridge, timed by the bridge's counters.
+fn bench_bridge(link: &mut dyn Link, frame: &[u8]) {
+    let commands = bridge_commands(frame, link.command_len());
+    let before = stats(link, 0);
+    let start = Instant::now();
+    for _ in 0..BENCH_FRAMES {
+        for command in commands.iter() {
+            link.send(command);
+        }
+    }
+    let counts = stats(link, 1).since(&before);
+    let secs = start.elapsed().as_secs_f64();
+    println!(
+        "Bridge: {} frames in {:.3}s, {:.1} frames/s, {:.0} I2C bytes/s, \
+         {} transactions, {} not acked",
+        BENCH_FRAMES,
+        secs,
+        BENCH_FRAMES as f64 / secs,
+        counts.bytes as f64 / secs,
+        counts.transactions,
+        counts.nacks
+    );
+}
+
+fn bench(link: &mut dyn Link) {
+    let frame: Vec<Vec<u8>> = (0..PAGES)
+        .map(|page| (0..WIDTH).map(|x| (x * 7 + page * 31) as u8).collect())
+        .collect();
+
+    // The link on its own, with pages below the display, which the
+    // firmware reads and drops.
+    bench_frames(link, "Link", PAGES, &frame, BENCH_LINK_FRAMES);
+    bench_frames(link, "Display", 0, &frame, BENCH_FRAMES);
+    bench_marquee(link, &frame);
+    bench_bridge(link, &frame.concat());
+
+    // Latency: change one tile, and time until it's been flushed.
+    let mut times = Vec::with_capacity(BENCH_ROUND_TRIPS);
+    for i in 0..BENCH_ROUND_TRIPS {
+        let start = Instant::now();
+        link.send(&tile_commands(0, &[b'0' + (i % 10) as u8], link.command_len())[0]);
+        flush(link, i as u8);
+        times.push(start.elapsed());
+    }
+    times.sort();
+    let mean = times.iter().sum::<Duration>() / times.len() as u32;
+    println!(
+        "{} round trips: min {:.2}ms, median {:.2}ms, mean {:.2}ms, max {:.2}ms",
+        BENCH_ROUND_TRIPS,
+        times[0].as_secs_f64() * 1e3,
+        times[times.len() / 2].as_secs_f64() * 1e3,
+        mean.as_secs_f64() * 1e3,
+        times[times.len() - 1].as_secs_f64() * 1e3
+    );
+}
+
+fn main() {
+    let mut args: Vec<String> = env::args().skip(1).collect();
+    let mut flag = |name: &str| match args.iter().position(|a| a == name) {
+        Some(i) => {
+            args.remove(i);
+            true
+        }
+        None => false,
+    };
+    let emulate = flag("--emulate");
+    let bulk = flag("--bulk");
+    let transport = if bulk { &BULK } else { &HID };
+    let mut link: Box<dyn Link> = match (emulate, bulk) {
+        (true, _) => Box::new(Emulated::new(transport, EMULATED_READ_TIME, EMULATED_BYTE_TIME)),
+        (false, true) => Box::new(Bulk::open()),
+        (false, false) => Box::new(Hidraw::open()),
+    };
+    println!("Using {}", transport.name);
+
+    match args.first().map(String::as_str) {
+        Some("image") if args.len() == 2 => send_image(link.as_mut(), Path::new(&args[1])),
+        Some("play") if args.len() >= 2 => play(link.as_mut(), &args[1..]),
+        Some("stream") if args.len() == 2 => stream(link.as_mut(), Path::new(&args[1])),
+        Some("bridge") if args.len() == 2 => send_bridge(link.as_mut(), Path::new(&args[1])),
+        Some("text") => send_text(link.as_mut(), &args[1..]),
+        Some("bench") if args.len() == 1 => bench(link.as_mut()),
+        _ => panic!(
+            "Usage: hid2teensy [--emulate] [--bulk] \
+             (image <image.png> | play <image.png>... | stream <anim.stream> | \
+             text <line>... | bridge <image.png> | bench)"
+        ),
+    }
+}
@@ -0,0 +1,26 @@
+//
+// log2teensy: Collect the LOG calls from the firmware's sources, and
+// print gen/logtokens.h, which gives each a token and a function to
+// send its record (see log.h).
+//
+// Usage: log2teensy --table <table> <source.c>...
+//
+// The table, of each token's name and format, is what teensylog needs
+// to turn the records back into text.
+//
+
+use std::env;
+use std::path::Path;
+
+use image2teensy::log::Tokens;
+
+fn main() {
+    let args: Vec<String> = env::args().skip(1).collect();
+    assert!(
+        args.len() >= 2 && args[0] == "--table",
+        "Usage: log2teensy --table <table> <source.c>..."
+    );
+    let tokens = Tokens::collect(&args[2..]);
+    tokens.write_table(Path::new(&args[1]));
+    tokens.write_header();
+}
@@ -0,0 +1,49 @@
+//
+// sprite2teensy: Convert a sheet of 16x16 sprites into an atlas for
+// the sprite layer.
+//
+// The sheet is 32 pixels high: sprites along the top 16 rows, and each
+// one's mask below it (white where the sprite is opaque). Pixels set
+// in the image but not the mask are dropped.
+//
+// Each sprite is output a column at a time, as image low page, image
+// high page, mask low page, mask high page, so the firmware can read
+// image and mask columns as 16-bit words.
+//
+// Usage: sprite2teensy <sheet.png>
+//
+
+use std::env;
+use std::path::Path;
+
+use image2teensy::{load_png, print_bytes, to_pages};
+
+const SPRITE_SIZE: usize = 16;
+
+fn main() {
+    let mut args = env::args();
+    assert_eq!(args.len(), 2);
+    let file_name_str = args.nth(1).unwrap();
+    let file_name = Path::new(&file_name_str);
+
+    let image = load_png(file_name);
+    assert_eq!(image.height as usize, 2 * SPRITE_SIZE);
+    assert_eq!(image.width as usize % SPRITE_SIZE, 0);
+    let count = image.width as usize / SPRITE_SIZE;
+
+    // Pages 0 and 1 are the images, 2 and 3 the masks.
+    let pages = to_pages(&image);
+
+    let stem = file_name.file_stem().unwrap().to_str().unwrap();
+    println!("static const char {}[] PROGMEM = {{", stem);
+    for sprite in 0..count {
+        println!("    // Sprite {}", sprite);
+        for x in sprite * SPRITE_SIZE..(sprite + 1) * SPRITE_SIZE {
+            let mask = [pages[2][x], pages[3][x]];
+            print_bytes(&[pages[0][x] & mask[0], pages[1][x] & mask[1], mask[0], mask[1]]);
+            println!();
+        }
+    }
+    println!("}};");
+    println!("static const int {}_count = {};", stem, count);
+}
@@ -0,0 +1,43 @@
+//
+// teensylog: Print what the firmware sends over USB debug, expanding
+// LOG records into text.
+//
+// Usage: teensylog <table> [capture]
+//
+// The table is gen/logtokens.txt, from the same build as the firmware.
+// With a capture file (the raw reports, as from "cat /dev/hidrawN"),
+// it decodes that rather than reading from an attached Teensy.
+//
+
+use std::env;
+use std::fs::File;
+use std::io::{self, Read, Write};
+use std::path::Path;
+
+use image2teensy::link;
+use image2teensy::log::{Decoder, Tokens};
+
+fn main() {
+    let args: Vec<String> = env::args().skip(1).collect();
+    assert!(
+        args.len() == 1 || args.len() == 2,
+        "Usage: teensylog <table> [capture]"
+    );
+    let mut decoder = Decoder::new(Tokens::read_table(Path::new(&args[0])));
+    let mut input = match args.get(1) {
+        Some(file_name) => File::open(file_name).unwrap_or_else(|e| panic!("{}: {}", file_name, e)),
+        None => link::open_debug(),
+    };
+
+    let stdout = io::stdout();
+    let mut out = stdout.lock();
+    let mut buf = [0u8; 64];
+    loop {
+        let n = input.read(&mut buf).expect("Read failed");
+        if n == 0 {
+            break;
+        }
+        out.write_all(decoder.feed(&buf[..n]).as_bytes()).unwrap();
+        out.flush().unwrap();
+    }
+}
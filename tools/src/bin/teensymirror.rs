@@ -0,0 +1,124 @@
+//
+// teensymirror: Show what's on the display of firmware built with
+// MIRROR, live in the terminal, by following the SSD1306 commands and
+// data it sends.
+//
+// Usage: teensymirror [--flip] [--no-quirks] [--table <table>] [capture]
+//
+// --flip turns the image round, for panels mounted upside down (built
+// with FLIPPED). --no-quirks follows the datasheet, rather than the
+// panel's column addressing quirks (see mirror.rs). The table,
+// gen/logtokens.txt, lets it skip LOG records cleanly when the firmware
+// sends those too. With a capture file (the raw reports, as from
+// "cat /dev/hidrawN"), it shows the display at the end of that, rather
+// than reading from an attached Teensy.
+//
+// Records dropped with the debug buffer full lose the rest of their
+// transaction, so parts of the image can be stale until redrawn. The
+// count of them is shown beneath.
+//
+
+use std::env;
+use std::fs::File;
+use std::io::Read;
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+use image2teensy::link;
+use image2teensy::log::{Decoder, Item, Tokens};
+use image2teensy::mirror::{Mirror, HEIGHT, WIDTH};
+
+const REFRESH: Duration = Duration::from_millis(33);
+
+// Two rows of pixels to a line of half blocks.
+fn show(mirror: &Mirror, flip: bool) {
+    let panel = &mirror.panel;
+    let pixel = |x: usize, y: usize| {
+        if flip {
+            panel.pixel(WIDTH - 1 - x, HEIGHT - 1 - y)
+        } else {
+            panel.pixel(x, y)
+        }
+    };
+    let mut out = String::new();
+    out.push_str(&format!("+{}+\n", "-".repeat(WIDTH)));
+    for y in (0..HEIGHT).step_by(2) {
+        out.push('|');
+        for x in 0..WIDTH {
+            out.push(match (pixel(x, y), pixel(x, y + 1)) {
+                (false, false) => ' ',
+                (true, false) => '\u{2580}',
+                (false, true) => '\u{2584}',
+                (true, true) => '\u{2588}',
+            });
+        }
+        out.push_str("|\n");
+    }
+    out.push_str(&format!("+{}+\n", "-".repeat(WIDTH)));
+    out.push_str(&format!(
+        "{} transactions, {} records, {} lost; display {}{}, contrast 0x{:02x}\n",
+        mirror.transactions,
+        mirror.records,
+        mirror.lost,
+        if panel.display_on { "on" } else { "off" },
+        if panel.inverted { ", inverted" } else { "" },
+        panel.contrast
+    ));
+    print!("{}", out);
+}
+
+fn main() {
+    let mut args: Vec<String> = env::args().skip(1).collect();
+    let mut flag = |name: &str| match args.iter().position(|a| a == name) {
+        Some(i) => {
+            args.remove(i);
+            true
+        }
+        None => false,
+    };
+    let flip = flag("--flip");
+    let quirks = !flag("--no-quirks");
+    let tokens = match args.iter().position(|a| a == "--table") {
+        Some(i) => {
+            let table = args.get(i + 1).cloned().expect("Missing --table file");
+            args.drain(i..i + 2);
+            Tokens::read_table(Path::new(&table))
+        }
+        None => Tokens { tokens: Vec::new() },
+    };
+    assert!(
+        args.len() <= 1,
+        "Usage: teensymirror [--flip] [--no-quirks] [--table <table>] [capture]"
+    );
+    let live = args.is_empty();
+    let mut input = match args.get(0) {
+        Some(file_name) => File::open(file_name).unwrap_or_else(|e| panic!("{}: {}", file_name, e)),
+        None => link::open_debug(),
+    };
+
+    let mut decoder = Decoder::new(tokens);
+    let mut mirror = Mirror::new(quirks);
+    let mut changed = false;
+    let mut shown = Instant::now();
+    let mut buf = [0u8; 64];
+    loop {
+        let n = input.read(&mut buf).expect("Read failed");
+        if n == 0 {
+            break;
+        }
+        for item in decoder.items(&buf[..n]) {
+            if let Item::Mirror { first, seq, bytes } = item {
+                mirror.record(first, seq, &bytes);
+                changed = true;
+            }
+        }
+        if live && changed && shown.elapsed() >= REFRESH {
+            // Redraw from the top of the terminal.
+            print!("\x1b[H\x1b[J");
+            show(&mirror, flip);
+            changed = false;
+            shown = Instant::now();
+        }
+    }
+    show(&mirror, flip);
+}
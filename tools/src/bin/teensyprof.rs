@@ -0,0 +1,106 @@
+//
+// teensyprof: Fetch the profile from firmware built with PROFILE, and
+// show where the time goes, by function.
+//
+// Usage: teensyprof [--seconds N] [--top N] [--buckets] <teensy_oled.elf>
+//
+// It samples for N seconds (default 10), fetching the histogram often
+// enough that its counts don't wrap, then shares each bucket's samples
+// between the functions in it, by size, using the ELF file the
+// firmware was built as (out/teensy_oled.elf). Inlined functions count
+// as part of their callers. With --buckets, it also lists the buckets
+// themselves.
+//
+
+use std::env;
+use std::path::Path;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use image2teensy::link;
+use image2teensy::profile::{attribute, bucket_functions, read_symbols, Profile};
+
+// The most any bucket gets is every sample, at about 1kHz, so this
+// leaves plenty of room before 16-bit counts wrap.
+const POLL: Duration = Duration::from_millis(500);
+
+fn main() {
+    let mut args: Vec<String> = env::args().skip(1).collect();
+    let mut option = |name: &str| match args.iter().position(|a| a == name) {
+        Some(i) => {
+            let value = args.get(i + 1).cloned().expect("Missing option value");
+            args.drain(i..i + 2);
+            Some(value)
+        }
+        None => None,
+    };
+    let seconds: u64 = option("--seconds").map_or(10, |v| v.parse().expect("Bad --seconds"));
+    let top: usize = option("--top").map_or(20, |v| v.parse().expect("Bad --top"));
+    let buckets = match args.iter().position(|a| a == "--buckets") {
+        Some(i) => {
+            args.remove(i);
+            true
+        }
+        None => false,
+    };
+    assert!(
+        args.len() == 1,
+        "Usage: teensyprof [--seconds N] [--top N] [--buckets] <teensy_oled.elf>"
+    );
+    let symbols = read_symbols(Path::new(&args[0]));
+
+    let file = link::open_debug();
+    let mut report = [0u8; 1024];
+    let fetch = |report: &mut [u8]| {
+        let n = link::get_feature(&file, report);
+        Profile::from_report(&report[..n])
+    };
+    let mut last = fetch(&mut report);
+    let mut profile = Profile::empty(&last);
+    let start = Instant::now();
+    while start.elapsed() < Duration::from_secs(seconds) {
+        thread::sleep(POLL);
+        let now = fetch(&mut report);
+        profile.add_since(&now, &last);
+        last = now;
+    }
+
+    let total = profile.total();
+    let percent = |n: f64| 100.0 * n / total.max(1) as f64;
+    println!(
+        "{} samples in {:.1}s, code from 0x{:04x} in {}-byte buckets",
+        total,
+        start.elapsed().as_secs_f64(),
+        profile.lo,
+        1 << profile.shift
+    );
+    println!(
+        "Blocked (interrupts, or interrupts off): {} ({:.1}%)",
+        profile.blocked,
+        percent(profile.blocked as f64)
+    );
+    if profile.outside > 0 {
+        println!("Outside the code: {} ({:.1}%)", profile.outside, percent(profile.outside as f64));
+    }
+    println!();
+    println!("{:>9} {:>6}  Function", "Samples", "%");
+    for (name, n) in attribute(&profile, &symbols).iter().take(top) {
+        let name = if name.is_empty() { "(no function)" } else { name };
+        println!("{:>9.1} {:>5.1}%  {}", n, percent(*n), name);
+    }
+
+    if buckets {
+        println!();
+        println!("{:>13} {:>9}  Functions", "Bucket", "Samples");
+        for (i, &n) in profile.counts.iter().enumerate().filter(|(_, &n)| n > 0) {
+            let (start, end) = profile.bucket(i);
+            println!(
+                "{:04x}-{:04x} {:>9}  {}",
+                start,
+                end - 1,
+                n,
+                bucket_functions(&profile, &symbols, i).join(", ")
+            );
+        }
+    }
+}
@@ -0,0 +1,179 @@
+//
+// teensystat: Show the telemetry the firmware sends when built with
+// TELEMETRY, as live stats and a histogram.
+//
+// Usage: teensystat [--hist <field>] <table> [capture]
+//
+// The table is gen/logtokens.txt, from the same build as the firmware.
+// With a capture file (the raw reports, as from "cat /dev/hidrawN"),
+// it shows the stats for that at the end, rather than reading from an
+// attached Teensy.
+//
+// Fields are those of the TELEMETRY record, named as in its format.
+// Those that are totals over the record's frames are shown per frame.
+// The histogram is of "cycles" per frame, unless --hist says otherwise.
+//
+
+use std::env;
+use std::fs::File;
+use std::io::Read;
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+use image2teensy::link;
+use image2teensy::log::{Decoder, Item, Tokens};
+
+// As in the Makefile.
+const F_CPU: f64 = 8_000_000.0;
+// Fields that aren't totals over the record's frames.
+const LEVELS: [&str; 4] = ["frame", "frames", "queued", "dropped"];
+const HIST_BUCKETS: usize = 16;
+const HIST_WIDTH: usize = 50;
+const REFRESH: Duration = Duration::from_millis(500);
+
+struct Field {
+    name: String,
+    samples: Vec<f64>,
+}
+
+impl Field {
+    fn min(&self) -> f64 {
+        self.samples.iter().cloned().fold(f64::INFINITY, f64::min)
+    }
+
+    fn max(&self) -> f64 {
+        self.samples.iter().cloned().fold(f64::NEG_INFINITY, f64::max)
+    }
+
+    fn mean(&self) -> f64 {
+        self.samples.iter().sum::<f64>() / self.samples.len() as f64
+    }
+}
+
+struct Stats {
+    fields: Vec<Field>,
+    records: usize,
+    // Frames skipped between records that arrived, as from records
+    // dropped with the debug buffer full.
+    missed: f64,
+    last_frame: Option<f64>,
+}
+
+impl Stats {
+    fn add(&mut self, values: &[f64]) {
+        let get = |name: &str| {
+            let i = self.fields.iter().position(|f| f.name == name);
+            values[i.unwrap_or_else(|| panic!("No \"{}\" in TELEMETRY", name))]
+        };
+        let (frame, frames) = (get("frame"), get("frames"));
+        if let Some(last) = self.last_frame {
+            self.missed += frame - last - frames;
+        }
+        self.last_frame = Some(frame);
+        self.records += 1;
+        for (field, value) in self.fields.iter_mut().zip(values.iter()) {
+            let per_frame = !LEVELS.contains(&field.name.as_str());
+            field.samples.push(if per_frame { value / frames } else { *value });
+        }
+    }
+
+    fn show(&self, hist: &str) {
+        println!("{} records, {} frames missed", self.records, self.missed);
+        if self.records == 0 {
+            return;
+        }
+        println!();
+        println!("{:>14} {:>12} {:>12} {:>12} {:>12}", "", "last", "min", "mean", "max");
+        for f in self.fields.iter().filter(|f| f.name != "frame" && f.name != "frames") {
+            println!(
+                "{:>14} {:>12.0} {:>12.0} {:>12.1} {:>12.0}",
+                f.name,
+                f.samples.last().unwrap(),
+                f.min(),
+                f.mean(),
+                f.max()
+            );
+        }
+        if let Some(f) = self.fields.iter().find(|f| f.name == "cycles") {
+            println!();
+            println!(
+                "{:.1} frames/s on average, {:.1} at worst",
+                F_CPU / f.mean(),
+                F_CPU / f.max()
+            );
+        }
+
+        let f = self.fields.iter().find(|f| f.name == hist);
+        let f = f.unwrap_or_else(|| panic!("No \"{}\" in TELEMETRY", hist));
+        let (min, max) = (f.min(), f.max());
+        let step = ((max - min) / HIST_BUCKETS as f64).max(1.0);
+        let mut counts = [0usize; HIST_BUCKETS];
+        for v in f.samples.iter() {
+            counts[(((v - min) / step) as usize).min(HIST_BUCKETS - 1)] += 1;
+        }
+        let most = *counts.iter().max().unwrap();
+        println!();
+        println!("{} per frame:", hist);
+        for (i, n) in counts.iter().enumerate() {
+            println!(
+                "{:>12.0} {:>7} {}",
+                min + step * i as f64,
+                n,
+                "#".repeat((n * HIST_WIDTH + most - 1) / most)
+            );
+        }
+    }
+}
+
+fn main() {
+    let mut args: Vec<String> = env::args().skip(1).collect();
+    let hist = match args.iter().position(|a| a == "--hist") {
+        Some(i) => {
+            let field = args.get(i + 1).cloned().expect("Missing --hist field");
+            args.drain(i..i + 2);
+            field
+        }
+        None => "cycles".to_string(),
+    };
+    assert!(
+        args.len() == 1 || args.len() == 2,
+        "Usage: teensystat [--hist <field>] <table> [capture]"
+    );
+    let mut decoder = Decoder::new(Tokens::read_table(Path::new(&args[0])));
+    let token = decoder.token_named("TELEMETRY").expect("No TELEMETRY in the table");
+    let id = token.id;
+    let mut stats = Stats {
+        fields: token.labels().into_iter().map(|name| Field { name, samples: Vec::new() }).collect(),
+        records: 0,
+        missed: 0.0,
+        last_frame: None,
+    };
+    let live = args.len() == 1;
+    let mut input = match args.get(1) {
+        Some(file_name) => File::open(file_name).unwrap_or_else(|e| panic!("{}: {}", file_name, e)),
+        None => link::open_debug(),
+    };
+
+    let mut shown = Instant::now();
+    let mut buf = [0u8; 64];
+    loop {
+        let n = input.read(&mut buf).expect("Read failed");
+        if n == 0 {
+            break;
+        }
+        for item in decoder.items(&buf[..n]) {
+            if let Item::Record(record_id, args) = item {
+                if record_id == id {
+                    stats.add(&decoder.token(id).values(&args));
+                }
+            }
+        }
+        if live && shown.elapsed() >= REFRESH {
+            // Clear the terminal, and redraw from the top.
+            print!("\x1b[H\x1b[J");
+            stats.show(&hist);
+            shown = Instant::now();
+        }
+    }
+    stats.show(&hist);
+}
@@ -0,0 +1,88 @@
+//
+// text2teensy: Render constant strings with the character set image
+// at build time, so the display code can just stream the columns out
+// of flash.
+//
+// Usage: text2teensy <charset.png> <extended.png> <extended.txt> <messages.txt>
+//
+// Strings are UTF-8. Characters not in the charset are taken from the
+// extended font (see font2teensy).
+//
+// Each non-blank line of the messages file that doesn't start with
+// '#' is a C identifier followed by a double-quoted string, e.g.
+//
+//     message_3 "Wobble!"
+//
+// The string may contain \" and \\ escapes.
+//
+
+use std::env;
+use std::fs;
+use std::path::Path;
+
+use image2teensy::{load_charset, load_extended_font, print_bytes};
+
+// Characters in neither font are displayed as this one.
+const MISSING_CHAR: char = '#';
+
+fn parse_line(line: &str) -> (String, String) {
+    let (name, rest) = line.split_at(line.find(char::is_whitespace).expect("Missing string"));
+    let rest = rest.trim();
+    assert!(rest.len() >= 2 && rest.starts_with('"') && rest.ends_with('"'),
+            "String must be double-quoted: {}", line);
+
+    let mut text = String::new();
+    let mut chars = rest[1..rest.len() - 1].chars();
+    while let Some(c) = chars.next() {
+        if c == '\\' {
+            text.push(chars.next().expect("Trailing backslash"));
+        } else {
+            text.push(c);
+        }
+    }
+    (name.to_string(), text)
+}
+
+// Escape a string for use as a C string literal.
+fn c_escape(text: &str) -> String {
+    text.chars()
+        .map(|c| match c {
+            '"' => "\\\"".to_string(),
+            '\\' => "\\\\".to_string(),
+            _ => c.to_string(),
+        })
+        .collect()
+}
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    assert_eq!(args.len(), 5);
+
+    let charset = load_charset(Path::new(&args[1]));
+    let extended = load_extended_font(Path::new(&args[2]), Path::new(&args[3]));
+
+    let messages = fs::read_to_string(&args[4]).unwrap();
+
+    println!("#include <avr/pgmspace.h>");
+    for line in messages.lines() {
+        let line = line.trim();
+        if line.is_empty() || line.starts_with('#') {
+            continue;
+        }
+        let (name, text) = parse_line(line);
+
+        println!();
+        println!("static const char {}[] = \"{}\";", name, c_escape(&text));
+        println!("static const char {}_cols[] PROGMEM = {{", name);
+        for c in text.chars() {
+            let glyph = charset.glyph(c)
+                .or_else(|| extended.glyph(c))
+                .or_else(|| charset.glyph(MISSING_CHAR))
+                .unwrap();
+            print_bytes(glyph);
+            println!("// {:?}", c);
+        }
+        println!("}};");
+        println!("static const int {}_cols_len = {};", name, text.chars().count() * 8);
+    }
+}
@@ -0,0 +1,94 @@
+//
+// wave2teensy: Generate trig and easing tables for effects, so they
+// don't need floating point at run time. Pair with fixed.h to
+// interpolate between entries.
+//
+// Usage: wave2teensy <curve>:<period>:<amplitude>[:<type>]...
+//
+// Curves:
+//   sin, cos    - One cycle over "period" entries. With an unsigned
+//                 type the values are offset to run from 0 to
+//                 2 * amplitude, with a signed one from -amplitude to
+//                 amplitude.
+//   linear, ease_in, ease_out, ease_in_out
+//               - From 0 to amplitude, over "period" + 1 entries so
+//                 the end point is included.
+//
+// Types are u8 (the default), i8, u16 and i16. Each table is named
+// <curve>_table_<period>_<amplitude>.
+//
+
+use std::env;
+use std::f64::consts::PI;
+
+struct ElemType {
+    c_name: &'static str,
+    min: i64,
+    max: i64,
+}
+
+fn elem_type(name: &str) -> ElemType {
+    match name {
+        "u8" => ElemType { c_name: "uint8_t", min: 0, max: 0xff },
+        "i8" => ElemType { c_name: "int8_t", min: -0x80, max: 0x7f },
+        "u16" => ElemType { c_name: "uint16_t", min: 0, max: 0xffff },
+        "i16" => ElemType { c_name: "int16_t", min: -0x8000, max: 0x7fff },
+        _ => panic!("Unknown type: {}", name),
+    }
+}
+
+// Values of "curve" over [0, 1] (or [0, 1) for periodic curves), in
+// the range -1 to 1 for periodic curves and 0 to 1 for easing curves.
+fn curve(name: &str, period: usize) -> (bool, Vec<f64>) {
+    let periodic = matches!(name, "sin" | "cos");
+    let len = if periodic { period } else { period + 1 };
+    let f: fn(f64) -> f64 = match name {
+        "sin" => |t| (2.0 * PI * t).sin(),
+        "cos" => |t| (2.0 * PI * t).cos(),
+        "linear" => |t| t,
+        "ease_in" => |t| t * t,
+        "ease_out" => |t| t * (2.0 - t),
+        "ease_in_out" => |t| t * t * (3.0 - 2.0 * t),
+        _ => panic!("Unknown curve: {}", name),
+    };
+    (periodic, (0..len).map(|i| f(i as f64 / period as f64)).collect())
+}
+
+fn main() {
+    println!("#include <stdint.h>");
+    println!("#include <avr/pgmspace.h>");
+    println!();
+
+    for arg in env::args().skip(1) {
+        let parts: Vec<&str> = arg.split(':').collect();
+        assert!(parts.len() == 3 || parts.len() == 4, "Bad table: {}", arg);
+        let name = parts[0];
+        let period: usize = parts[1].parse().expect("Bad period");
+        let amplitude: i64 = parts[2].parse().expect("Bad amplitude");
+        let ty = elem_type(parts.get(3).copied().unwrap_or("u8"));
+
+        let (periodic, values) = curve(name, period);
+        // Periodic curves are made non-negative for unsigned types.
+        let bias = if periodic && ty.min == 0 { amplitude } else { 0 };
+        let values: Vec<i64> = values
+            .iter()
+            .map(|v| (v * amplitude as f64).round() as i64 + bias)
+            .collect();
+        for &v in values.iter() {
+            assert!(ty.min <= v && v <= ty.max, "{} out of range in {}", v, arg);
+        }
+
+        let ident = format!("{}_table_{}_{}", name, period, amplitude);
+        println!("static const {} {}[] PROGMEM = {{", ty.c_name, ident);
+        for chunk in values.chunks(16) {
+            print!("    ");
+            for v in chunk {
+                print!("{}, ", v);
+            }
+            println!();
+        }
+        println!("}};");
+        println!("static const int {}_len = {};", ident, values.len());
+        println!();
+    }
+}
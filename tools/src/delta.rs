@@ -0,0 +1,203 @@
+//
+// Delta frames: a frame described by how it differs from the last.
+// See "Delta frames" in teensy_oled.c for the format.
+//
+// Frames are 512 bytes, a page (128 bytes) at a time, as the display
+// holds them.
+//
+
+pub const DELTA_SKIP: u8 = 0x00;
+pub const DELTA_FILL: u8 = 0x40;
+pub const DELTA_LITERAL: u8 = 0x80;
+pub const DELTA_SEEK: u8 = 0xc0;
+pub const DELTA_OP_MASK: u8 = 0xc0;
+
+// Longest run a single op covers.
+pub const MAX_RUN: usize = 64;
+
+// One op, at the position it applies from, with its bytes.
+pub struct Op {
+    pub pos: usize,
+    pub bytes: Vec<u8>,
+}
+
+// How to get from position i to j: the ops that can end at each.
+#[derive(Clone, Copy)]
+enum Step {
+    Skip,
+    Seek,
+    Fill,
+    Literal,
+}
+
+// Encodes "frame" as the smallest sequence of ops that turns "prev"
+// into it, or draws it from scratch if there's no "prev". Returns the
+// ops, and the position the first applies from; nothing after the
+// last change is encoded.
+//
+// Finds the cheapest encoding by dynamic programming over positions:
+// the cheapest way to reach each is the cheapest of a run of each
+// kind of op ending there. Skips and seeks only cover unchanged bytes.
+pub fn encode(prev: Option<&[u8]>, frame: &[u8]) -> (usize, Vec<Op>) {
+    let len = frame.len();
+    let changed: Vec<bool> = match prev {
+        Some(prev) => frame.iter().zip(prev).map(|(a, b)| a != b).collect(),
+        None => vec![true; len],
+    };
+    let start = match changed.iter().position(|&c| c) {
+        Some(start) => start,
+        None => return (0, Vec::new()),
+    };
+    let end = changed.iter().rposition(|&c| c).unwrap() + 1;
+
+    // cost[i] is the fewest bytes taking us from "start" to i, with
+    // how we got there.
+    let mut cost = vec![usize::MAX; end + 1];
+    let mut how = vec![(start, Step::Skip); end + 1];
+    cost[start] = 0;
+    // Where the run of unchanged bytes ending at each position starts.
+    let mut unchanged_from = start;
+    for j in start + 1..=end {
+        if changed[j - 1] {
+            unchanged_from = j;
+        }
+        let mut consider = |i: usize, c: usize, step: Step| {
+            if cost[i] != usize::MAX && cost[i] + c < cost[j] {
+                cost[j] = cost[i] + c;
+                how[j] = (i, step);
+            }
+        };
+        let lo = j.saturating_sub(MAX_RUN).max(start);
+        let mut same = true;
+        for i in (lo..j).rev() {
+            consider(i, 1 + j - i, Step::Literal);
+            same &= frame[i] == frame[j - 1];
+            if same {
+                consider(i, 2, Step::Fill);
+            }
+            if i >= unchanged_from {
+                consider(i, 1, Step::Skip);
+            }
+        }
+        if unchanged_from < j - 1 {
+            // A seek covers any distance, so only the longest is worth
+            // considering.
+            consider(unchanged_from, 2, Step::Seek);
+        }
+    }
+
+    let mut steps = Vec::new();
+    let mut j = end;
+    while j > start {
+        let (i, step) = how[j];
+        steps.push((i, j, step));
+        j = i;
+    }
+    steps.reverse();
+
+    let ops = steps
+        .into_iter()
+        .map(|(i, j, step)| {
+            let n = (j - i - 1) as u8;
+            let bytes = match step {
+                Step::Skip => vec![DELTA_SKIP | n],
+                Step::Seek => vec![DELTA_SEEK | (j >> 8) as u8, j as u8],
+                Step::Fill => vec![DELTA_FILL | n, frame[i]],
+                Step::Literal => {
+                    let mut bytes = vec![DELTA_LITERAL | n];
+                    bytes.extend_from_slice(&frame[i..j]);
+                    bytes
+                }
+            };
+            Op { pos: i, bytes }
+        })
+        .collect();
+    (start, ops)
+}
+
+// Splits "bytes" back into ops, tracking the position each applies
+// from, starting at "pos".
+pub fn parse(mut pos: usize, bytes: &[u8]) -> Vec<Op> {
+    let mut ops = Vec::new();
+    let mut i = 0;
+    while i < bytes.len() {
+        let op = bytes[i];
+        let n = (op & !DELTA_OP_MASK) as usize + 1;
+        let (len, next_pos) = match op & DELTA_OP_MASK {
+            DELTA_SKIP => (1, pos + n),
+            DELTA_FILL => (2, pos + n),
+            DELTA_LITERAL => (1 + n, pos + n),
+            _ => (2, ((op & !DELTA_OP_MASK) as usize) << 8 | bytes[i + 1] as usize),
+        };
+        ops.push(Op { pos, bytes: bytes[i..i + len].to_vec() });
+        pos = next_pos;
+        i += len;
+    }
+    ops
+}
+
+// Applies ops to "frame", from position "pos", as the firmware would.
+// Returns the spans written, as (position, length), for the caller to
+// cost them.
+pub fn decode(ops: &[u8], mut pos: usize, frame: &mut [u8]) -> Vec<(usize, usize)> {
+    let mut spans = Vec::new();
+    let mut i = 0;
+    while i < ops.len() {
+        let op = ops[i];
+        let n = (op & !DELTA_OP_MASK) as usize + 1;
+        i += 1;
+        match op & DELTA_OP_MASK {
+            DELTA_SKIP => (),
+            DELTA_FILL => {
+                let b = match ops.get(i) {
+                    Some(&b) => b,
+                    None => break,
+                };
+                i += 1;
+                span(frame, pos, n, &mut spans, |_| b);
+            }
+            DELTA_LITERAL => {
+                let n = n.min(ops.len() - i);
+                let src = &ops[i..i + n];
+                i += n;
+                span(frame, pos, n, &mut spans, |k| src[k]);
+            }
+            _ => {
+                let lo = match ops.get(i) {
+                    Some(&lo) => lo,
+                    None => break,
+                };
+                i += 1;
+                pos = ((op & !DELTA_OP_MASK) as usize) << 8 | lo as usize;
+                continue;
+            }
+        }
+        pos += n;
+    }
+    spans
+}
+
+// Writes a span of "n" bytes at "pos", split at page ends, as the
+// firmware sends them. Anything off the end of the frame is dropped.
+fn span(
+    frame: &mut [u8],
+    pos: usize,
+    n: usize,
+    spans: &mut Vec<(usize, usize)>,
+    byte: impl Fn(usize) -> u8,
+) {
+    let mut done = 0;
+    while done < n {
+        let p = pos + done;
+        let count = (128 - p % 128).min(n - done);
+        if p < frame.len() {
+            spans.push((p, count));
+        }
+        for k in 0..count {
+            if let Some(b) = frame.get_mut(p + k) {
+                *b = byte(done + k);
+            }
+        }
+        done += count;
+    }
+}
@@ -0,0 +1,182 @@
+//
+// Shared code for the tools that convert images (and things rendered
+// from them) into data usable on an SSD 1780 display.
+//
+
+use std::fs::File;
+use std::path::Path;
+
+pub mod anim;
+pub mod delta;
+pub mod link;
+pub mod log;
+pub mod mirror;
+pub mod profile;
+
+// An 8-bit greyscale image.
+pub struct Image {
+    pub width: u32,
+    pub height: u32,
+    pub pixels: Vec<u8>,
+}
+
+pub fn load_png(file_name: &Path) -> Image {
+    let decoder = png::Decoder::new(File::open(file_name).unwrap());
+    let (info, mut reader) = decoder.read_info().unwrap();
+    // Allocate the output buffer.
+    let mut buf = vec![0; info.buffer_size()];
+    // Read the next frame. An APNG might contain multiple frames.
+    reader.next_frame(&mut buf).unwrap();
+
+    assert_eq!(info.color_type, png::ColorType::Grayscale);
+    assert_eq!(info.bit_depth, png::BitDepth::Eight);
+
+    Image {
+        width: info.width,
+        height: info.height,
+        pixels: buf,
+    }
+}
+
+// Transpose an 8x8 bit matrix held a row per byte, least significant
+// byte first: bit i of byte j becomes bit j of byte i. The same as
+// bits_transpose in the firmware, done by swapping ever smaller blocks
+// within a 64-bit word.
+pub fn transpose8x8(x: u64) -> u64 {
+    let t = (x ^ (x >> 7)) & 0x00aa_00aa_00aa_00aa;
+    let x = x ^ t ^ (t << 7);
+    let t = (x ^ (x >> 14)) & 0x0000_cccc_0000_cccc;
+    let x = x ^ t ^ (t << 14);
+    let t = (x ^ (x >> 28)) & 0x0000_0000_f0f0_f0f0;
+    x ^ t ^ (t << 28)
+}
+
+// The column bytes of 8 rows of pixels, "x" to "x" + 7 (which must be
+// within the image), starting at row "y". Rows past the bottom are
+// blank.
+fn page_block(image: &Image, x: u32, y: u32) -> [u8; 8] {
+    let mut rows: u64 = 0;
+    for dy in 0..8 {
+        if y + dy >= image.height {
+            break;
+        }
+        let start = ((y + dy) * image.width + x) as usize;
+        let mut row: u64 = 0;
+        for (dx, &p) in image.pixels[start..start + 8].iter().enumerate() {
+            row |= ((p >> 7) as u64) << dx;
+        }
+        rows |= row << (dy * 8);
+    }
+    transpose8x8(rows).to_le_bytes()
+}
+
+// As page_block, but 16 columns at a time with SSE2. Each pixel's top
+// bit is shifted into place and the rows ORed together, a byte per
+// column.
+#[cfg(target_arch = "x86_64")]
+fn page_block_16(image: &Image, x: u32, y: u32) -> [u8; 16] {
+    use std::arch::x86_64::*;
+    let mut out = [0u8; 16];
+    // SSE2 is always there on x86_64.
+    unsafe {
+        let mut acc = _mm_setzero_si128();
+        for dy in 0..8 {
+            if y + dy >= image.height {
+                break;
+            }
+            let start = ((y + dy) * image.width + x) as usize;
+            let row = _mm_loadu_si128(image.pixels[start..start + 16].as_ptr() as *const __m128i);
+            // 16-bit shifts leak bits between bytes; the mask drops them.
+            let bit = _mm_and_si128(
+                _mm_srl_epi16(row, _mm_cvtsi32_si128(7 - dy as i32)),
+                _mm_set1_epi8(1 << dy),
+            );
+            acc = _mm_or_si128(acc, bit);
+        }
+        _mm_storeu_si128(out.as_mut_ptr() as *mut __m128i, acc);
+    }
+    out
+}
+
+// Break image apart into 8 pixel rows, record each 8-bit column. Each
+// page is returned as a separate vector of columns.
+pub fn to_pages(image: &Image) -> Vec<Vec<u8>> {
+    let w = image.width;
+    let h = image.height;
+    let mut pages = Vec::new();
+    for y_page in 0..(h + 7) / 8 {
+        let y = y_page * 8;
+        let mut page = Vec::with_capacity(w as usize);
+        let mut x = 0;
+        #[cfg(target_arch = "x86_64")]
+        while x + 16 <= w {
+            page.extend_from_slice(&page_block_16(image, x, y));
+            x += 16;
+        }
+        while x + 8 <= w {
+            page.extend_from_slice(&page_block(image, x, y));
+            x += 8;
+        }
+        // Any columns left over, one at a time.
+        for x in x..w {
+            let mut c: u8 = 0;
+            for dy in 0..8 {
+                if y + dy < h && image.pixels[((y + dy) * w + x) as usize] >= 0x80 {
+                    c |= 1 << dy;
+                }
+            }
+            page.push(c);
+        }
+        pages.push(page);
+    }
+    pages
+}
+
+// Print a line of bytes in C array initialiser style.
+pub fn print_bytes(bytes: &[u8]) {
+    print!("    ");
+    for c in bytes.iter() {
+        print!("0x{:02x}, ", c);
+    }
+}
+
+// A set of 8x8 glyphs, laid out 16 across in an image, with the
+// character each represents.
+pub struct Font {
+    glyphs: std::collections::BTreeMap<char, Vec<u8>>,
+}
+
+impl Font {
+    pub fn new(image: &Image, chars: impl Iterator<Item = char>) -> Font {
+        assert_eq!(image.width, 128);
+        let pages = to_pages(image);
+        let mut glyphs = std::collections::BTreeMap::new();
+        for (idx, c) in chars.enumerate() {
+            let page = &pages[idx / 16];
+            let start = (idx % 16) * 8;
+            glyphs.insert(c, page[start..start + 8].to_vec());
+        }
+        Font { glyphs }
+    }
+
+    pub fn glyph(&self, c: char) -> Option<&[u8]> {
+        self.glyphs.get(&c).map(|g| g.as_slice())
+    }
+
+    // Glyphs in code point order.
+    pub fn iter(&self) -> impl Iterator<Item = (&char, &Vec<u8>)> {
+        self.glyphs.iter()
+    }
+}
+
+// The ZX Spectrum character set, starting at character 32.
+pub fn load_charset(file_name: &Path) -> Font {
+    Font::new(&load_png(file_name), (32u8..128).map(|c| c as char))
+}
+
+// A font of extra characters. The accompanying text file lists the
+// characters in the same order as the image.
+pub fn load_extended_font(image_name: &Path, chars_name: &Path) -> Font {
+    let chars = std::fs::read_to_string(chars_name).unwrap();
+    Font::new(&load_png(image_name), chars.chars().filter(|c| !c.is_whitespace()))
+}
@@ -0,0 +1,620 @@
+//
+// The host side of the firmware's host link: building the commands it
+// understands, and the transports that carry them.
+//
+// See "Host link" in teensy_oled.c for the protocol itself.
+//
+
+use std::fs::{self, File, OpenOptions};
+use std::io::{Read, Write};
+use std::os::raw::{c_int, c_uint, c_ulong, c_void};
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::sync::mpsc::{self, Receiver, SyncSender, TryRecvError, TrySendError};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use crate::delta::{self, Op, DELTA_LITERAL};
+
+pub const LINK_DATA: u8 = 0x01;
+pub const LINK_TILES: u8 = 0x02;
+pub const LINK_FLUSH: u8 = 0x03;
+pub const LINK_DELTA: u8 = 0x04;
+pub const LINK_I2C: u8 = 0x05;
+pub const LINK_STATS: u8 = 0x06;
+
+pub const I2C_START: u8 = 0x01;
+pub const I2C_STOP: u8 = 0x02;
+
+pub const TILE_COLS: usize = 16;
+
+// Commands to send "pages" (as from to_pages) straight to the display,
+// from "first_page" down, with at most "command_len" bytes in each.
+pub fn data_commands(first_page: usize, pages: &[Vec<u8>], command_len: usize) -> Vec<Vec<u8>> {
+    let max = (command_len - 4).min(255);
+    let mut commands = Vec::new();
+    for (page, columns) in pages.iter().enumerate() {
+        for (i, chunk) in columns.chunks(max).enumerate() {
+            let mut command = vec![
+                LINK_DATA,
+                (first_page + page) as u8,
+                (i * max) as u8,
+                chunk.len() as u8,
+            ];
+            command.extend_from_slice(chunk);
+            commands.push(command);
+        }
+    }
+    commands
+}
+
+// Commands to put "tiles" in the tile map, starting from tile "first".
+pub fn tile_commands(first: usize, tiles: &[u8], command_len: usize) -> Vec<Vec<u8>> {
+    let max = (command_len - 3).min(255);
+    let mut commands = Vec::new();
+    for (i, chunk) in tiles.chunks(max).enumerate() {
+        let mut command = vec![LINK_TILES, (first + i * max) as u8, chunk.len() as u8];
+        command.extend_from_slice(chunk);
+        commands.push(command);
+    }
+    commands
+}
+
+// Commands to turn "prev" into "frame" (or draw it, with no "prev"),
+// as delta frames, with at most "command_len" bytes in each.
+pub fn delta_commands(prev: Option<&[u8]>, frame: &[u8], command_len: usize) -> Vec<Vec<u8>> {
+    let (_, ops) = delta::encode(prev, frame);
+    ops_commands(&ops, command_len)
+}
+
+// Commands to send delta frame ops. Each command starts where its
+// first op applies, so literals too long for a command are split in
+// two.
+pub fn ops_commands(ops: &[Op], command_len: usize) -> Vec<Vec<u8>> {
+    let max = (command_len - 4).min(255);
+    let mut commands = Vec::new();
+    let mut command: Vec<u8> = Vec::new();
+    let mut add = |pos: usize, bytes: &[u8]| {
+        if command.len() + bytes.len() > 4 + max {
+            commands.push(std::mem::take(&mut command));
+        }
+        if command.is_empty() {
+            command = vec![LINK_DELTA, (pos >> 8) as u8, pos as u8, 0];
+        }
+        command.extend_from_slice(bytes);
+        command[3] = (command.len() - 4) as u8;
+    };
+    for op in ops.iter() {
+        if op.bytes.len() <= max {
+            add(op.pos, &op.bytes);
+        } else {
+            let data = &op.bytes[1..];
+            let (first, rest) = data.split_at(max - 1);
+            add(op.pos, &[&[DELTA_LITERAL | (first.len() - 1) as u8], first].concat());
+            add(op.pos + first.len(), &[&[DELTA_LITERAL | (rest.len() - 1) as u8], rest].concat());
+        }
+    }
+    if !command.is_empty() {
+        commands.push(command);
+    }
+    commands
+}
+
+pub fn flush_command(tag: u8) -> Vec<u8> {
+    vec![LINK_FLUSH, tag]
+}
+
+// Commands for the bridge to send "bytes" to "addr" as one I2C
+// transaction, split over as many commands as it takes.
+pub fn i2c_commands(addr: u8, bytes: &[u8], command_len: usize) -> Vec<Vec<u8>> {
+    let max = (command_len - 4).min(255);
+    let chunks: Vec<&[u8]> = bytes.chunks(max).collect();
+    chunks
+        .iter()
+        .enumerate()
+        .map(|(i, chunk)| {
+            let mut flags = 0;
+            if i == 0 {
+                flags |= I2C_START;
+            }
+            if i == chunks.len() - 1 {
+                flags |= I2C_STOP;
+            }
+            let mut command = vec![LINK_I2C, addr, flags, chunk.len() as u8];
+            command.extend_from_slice(chunk);
+            command
+        })
+        .collect()
+}
+
+pub fn stats_command(tag: u8) -> Vec<u8> {
+    vec![LINK_STATS, tag]
+}
+
+// The bridge's counters, as in the reply to LINK_STATS. They count up
+// from reset, wrapping.
+#[derive(Clone, Copy, Default)]
+pub struct BridgeStats {
+    // Bytes acked, including addresses.
+    pub bytes: u32,
+    pub transactions: u32,
+    pub nacks: u16,
+}
+
+impl BridgeStats {
+    pub fn from_reply(reply: &[u8]) -> BridgeStats {
+        let u32_at = |i: usize| u32::from_le_bytes([reply[i], reply[i + 1], reply[i + 2], reply[i + 3]]);
+        BridgeStats {
+            bytes: u32_at(2),
+            transactions: u32_at(6),
+            nacks: u16::from_le_bytes([reply[10], reply[11]]),
+        }
+    }
+
+    fn to_reply(&self, tag: u8) -> Vec<u8> {
+        let mut reply = vec![LINK_STATS, tag];
+        reply.extend_from_slice(&self.bytes.to_le_bytes());
+        reply.extend_from_slice(&self.transactions.to_le_bytes());
+        reply.extend_from_slice(&self.nacks.to_le_bytes());
+        reply
+    }
+
+    // The counts since "earlier".
+    pub fn since(&self, earlier: &BridgeStats) -> BridgeStats {
+        BridgeStats {
+            bytes: self.bytes.wrapping_sub(earlier.bytes),
+            transactions: self.transactions.wrapping_sub(earlier.transactions),
+            nacks: self.nacks.wrapping_sub(earlier.nacks),
+        }
+    }
+}
+
+// Something that carries commands to the firmware and replies back.
+pub trait Link {
+    // Most bytes in one command, including its header.
+    fn command_len(&self) -> usize;
+    // May hold on to commands until the next recv.
+    fn send(&mut self, command: &[u8]);
+    fn recv(&mut self) -> Vec<u8>;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Transports
+//
+// Raw HID sends each command as a 64-byte report, one per 1ms frame.
+// The bulk interface (with BULK_LINK) takes a stream of commands, in
+// as many 64-byte packets per frame as the bus has room for.
+//
+
+pub struct Transport {
+    pub name: &'static str,
+    pub packet_size: usize,
+    pub packets_per_frame: u32,
+    pub command_len: usize,
+    // Whether each command is padded out to a packet of its own.
+    pub framed: bool,
+}
+
+pub const HID: Transport = Transport {
+    name: "raw HID",
+    packet_size: 64,
+    packets_per_frame: 1,
+    command_len: 64,
+    framed: true,
+};
+
+// 19 packets is about what a full-speed bus fits in a frame.
+pub const BULK: Transport = Transport {
+    name: "bulk",
+    packet_size: 64,
+    packets_per_frame: 19,
+    command_len: 4 + 255,
+    framed: false,
+};
+
+// How much to gather up before writing, on streaming transports.
+const STREAM_CHUNK: usize = 4096;
+
+////////////////////////////////////////////////////////////////////////
+// Real hardware, on Linux.
+//
+
+const VENDOR_ID: u32 = 0x16c0;
+const PRODUCT_ID: u32 = 0x0479;
+// Each interface's usage page, as the first item of its report
+// descriptor. The two have the same IDs.
+const RAW_USAGE_PAGE_ITEM: [u8; 3] = [0x06, 0xab, 0xff];
+const DEBUG_USAGE_PAGE_ITEM: [u8; 3] = [0x06, 0x31, 0xff];
+
+// Finds the hidraw device for an attached Teensy's interface.
+fn find_hidraw(usage_page_item: &[u8]) -> Option<PathBuf> {
+    let id = format!("HID_ID=0003:{:08X}:{:08X}", VENDOR_ID, PRODUCT_ID);
+    for entry in fs::read_dir("/sys/class/hidraw").expect("No hidraw") {
+        let entry = entry.unwrap();
+        let device = entry.path().join("device");
+        let uevent = fs::read_to_string(device.join("uevent")).unwrap_or_default();
+        let descriptor = fs::read(device.join("report_descriptor")).unwrap_or_default();
+        if uevent.lines().any(|l| l == id) && descriptor.starts_with(usage_page_item) {
+            return Some(PathBuf::from("/dev").join(entry.file_name()));
+        }
+    }
+    None
+}
+
+// The debug interface, which only sends. Reads give a report at a time.
+pub fn open_debug() -> File {
+    let path = find_hidraw(&DEBUG_USAGE_PAGE_ITEM).expect("No Teensy debug interface found");
+    File::open(&path).unwrap_or_else(|e| panic!("Can't open {}: {}", path.display(), e))
+}
+
+// Linux's HIDIOCGFEATURE, for a report of up to "len" bytes.
+const fn hidiocgfeature(len: usize) -> c_ulong {
+    (3 << 30) | ((len as c_ulong) << 16) | ((b'H' as c_ulong) << 8) | 0x07
+}
+
+// Fetches feature report 0 of a hidraw device, returning its length.
+pub fn get_feature(file: &File, report: &mut [u8]) -> usize {
+    // The first byte says which report, and comes back as it was.
+    let mut buf = vec![0u8; report.len() + 1];
+    let r = unsafe { ioctl(file.as_raw_fd(), hidiocgfeature(buf.len()), buf.as_mut_ptr()) };
+    assert!(r >= 1, "Can't get feature report: {}", std::io::Error::last_os_error());
+    let n = r as usize - 1;
+    report[..n].copy_from_slice(&buf[1..=n]);
+    n
+}
+
+// Raw HID, through the hidraw driver.
+pub struct Hidraw {
+    file: File,
+}
+
+impl Hidraw {
+    // Finds the raw HID interface of an attached Teensy.
+    pub fn open() -> Hidraw {
+        let path = find_hidraw(&RAW_USAGE_PAGE_ITEM).expect("No Teensy raw HID interface found");
+        Hidraw { file: open_rw(&path) }
+    }
+}
+
+fn open_rw(path: &Path) -> File {
+    OpenOptions::new()
+        .read(true)
+        .write(true)
+        .open(path)
+        .unwrap_or_else(|e| panic!("Can't open {}: {}", path.display(), e))
+}
+
+impl Link for Hidraw {
+    fn command_len(&self) -> usize {
+        HID.command_len
+    }
+
+    fn send(&mut self, command: &[u8]) {
+        // Report ID 0 first, as the descriptor doesn't use IDs.
+        let mut buf = [0; 65];
+        buf[1..1 + command.len()].copy_from_slice(command);
+        self.file.write_all(&buf).unwrap();
+    }
+
+    fn recv(&mut self) -> Vec<u8> {
+        let mut report = vec![0; HID.packet_size];
+        self.file.read_exact(&mut report).unwrap();
+        report
+    }
+}
+
+// The bulk interface, through usbfs. Nothing else claims a vendor
+// interface, but the device node needs to be writable (e.g. with a
+// udev rule).
+pub struct Bulk {
+    file: File,
+    pending: Vec<u8>,
+}
+
+const BULK_INTERFACE: c_uint = 2;
+const BULK_OUT_ENDPOINT: c_uint = 0x04;
+const BULK_IN_ENDPOINT: c_uint = 0x85;
+const BULK_TIMEOUT_MS: c_uint = 1000;
+
+// From linux/usbdevice_fs.h.
+#[repr(C)]
+struct UsbdevfsBulkTransfer {
+    ep: c_uint,
+    len: c_uint,
+    timeout: c_uint,
+    data: *mut c_void,
+}
+
+extern "C" {
+    fn ioctl(fd: c_int, request: c_ulong, ...) -> c_int;
+}
+
+// Linux's _IOR and _IOWR, for usbfs ('U') requests.
+const fn usbfs_ioctl(dir: c_ulong, nr: c_ulong, size: usize) -> c_ulong {
+    (dir << 30) | ((size as c_ulong) << 16) | ((b'U' as c_ulong) << 8) | nr
+}
+const USBDEVFS_BULK: c_ulong = usbfs_ioctl(3, 2, std::mem::size_of::<UsbdevfsBulkTransfer>());
+const USBDEVFS_CLAIMINTERFACE: c_ulong = usbfs_ioctl(2, 15, std::mem::size_of::<c_uint>());
+
+impl Bulk {
+    // Finds an attached Teensy, and claims its bulk interface.
+    pub fn open() -> Bulk {
+        for entry in fs::read_dir("/sys/bus/usb/devices").expect("No usb") {
+            let dir = entry.unwrap().path();
+            let attr = |name: &str| fs::read_to_string(dir.join(name)).unwrap_or_default();
+            let hex = |name: &str| u32::from_str_radix(attr(name).trim(), 16).ok();
+            if hex("idVendor") != Some(VENDOR_ID) || hex("idProduct") != Some(PRODUCT_ID) {
+                continue;
+            }
+            let bus: u32 = attr("busnum").trim().parse().unwrap();
+            let dev: u32 = attr("devnum").trim().parse().unwrap();
+            let file = open_rw(Path::new(&format!("/dev/bus/usb/{:03}/{:03}", bus, dev)));
+            let interface = BULK_INTERFACE;
+            let r = unsafe { ioctl(file.as_raw_fd(), USBDEVFS_CLAIMINTERFACE, &interface) };
+            assert!(r == 0, "Can't claim the bulk interface (built without BULK_LINK?)");
+            return Bulk { file, pending: Vec::new() };
+        }
+        panic!("No Teensy found");
+    }
+
+    fn transfer(&mut self, ep: c_uint, data: &mut [u8]) -> usize {
+        let mut xfer = UsbdevfsBulkTransfer {
+            ep,
+            len: data.len() as c_uint,
+            timeout: BULK_TIMEOUT_MS,
+            data: data.as_mut_ptr() as *mut c_void,
+        };
+        let r = unsafe { ioctl(self.file.as_raw_fd(), USBDEVFS_BULK, &mut xfer) };
+        assert!(r >= 0, "Bulk transfer failed");
+        r as usize
+    }
+
+    fn flush(&mut self) {
+        let mut pending = std::mem::take(&mut self.pending);
+        if !pending.is_empty() {
+            self.transfer(BULK_OUT_ENDPOINT, &mut pending);
+        }
+    }
+}
+
+impl Link for Bulk {
+    fn command_len(&self) -> usize {
+        BULK.command_len
+    }
+
+    fn send(&mut self, command: &[u8]) {
+        self.pending.extend_from_slice(command);
+        if self.pending.len() >= STREAM_CHUNK {
+            self.flush();
+        }
+    }
+
+    fn recv(&mut self) -> Vec<u8> {
+        self.flush();
+        let mut reply = vec![0; 16];
+        let n = self.transfer(BULK_IN_ENDPOINT, &mut reply);
+        reply.truncate(n);
+        reply
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// An emulated stand-in, for benchmarking without the hardware.
+//
+// Models the parts that set the speed: how many packets the bus lets
+// through per 1ms frame, the double-buffered endpoint, the firmware's
+// time to read each byte, and the time to send those for the display
+// over I2C. Commands are timed, not displayed.
+//
+
+const FRAME: Duration = Duration::from_millis(1);
+const BANKS: usize = 2;
+// I2C bytes to start a span: setting page mode and the position, then
+// starting the data.
+const SPAN_SETUP: usize = 9;
+
+pub struct Emulated {
+    transport: &'static Transport,
+    pending: Vec<u8>,
+    to_wire: SyncSender<Vec<u8>>,
+    replies: Receiver<Vec<u8>>,
+}
+
+// The firmware's view of what's arrived: bytes, pulled from the
+// endpoint a packet at a time.
+struct EmulatedEndpoint {
+    banks: Receiver<Vec<u8>>,
+    packet: Vec<u8>,
+    pos: usize,
+    // Whether it's had to wait for a packet since this was last cleared.
+    waited: bool,
+}
+
+impl EmulatedEndpoint {
+    fn next(&mut self) -> Option<u8> {
+        while self.pos == self.packet.len() {
+            let (packet, waited) = recv_noting_wait(&self.banks)?;
+            self.packet = packet;
+            self.pos = 0;
+            self.waited |= waited;
+        }
+        self.pos += 1;
+        Some(self.packet[self.pos - 1])
+    }
+
+    // Drops the rest of the packet, for framed transports.
+    fn end_packet(&mut self) {
+        self.pos = self.packet.len();
+    }
+}
+
+impl Emulated {
+    // "read_time" is how long the firmware takes to get a byte out of
+    // the endpoint, and "byte_time" to send one over I2C, including its
+    // share of the start, address and stop.
+    pub fn new(transport: &'static Transport, read_time: Duration, byte_time: Duration) -> Emulated {
+        let (to_wire, wire) = mpsc::sync_channel::<Vec<u8>>(0);
+        let (to_banks, banks) = mpsc::sync_channel::<Vec<u8>>(BANKS);
+        let (to_host, replies) = mpsc::channel();
+
+        // The bus: packets in evenly spaced slots, none getting through
+        // while both banks are full (the device NAKs, and the host
+        // retries in a later slot). Times are kept as a schedule, so
+        // oversleeping doesn't add up.
+        let slot = FRAME / transport.packets_per_frame;
+        thread::spawn(move || {
+            let mut next_slot = Instant::now();
+            while let Some((mut packet, waited)) = recv_noting_wait(&wire) {
+                if waited {
+                    next_slot = next_slot.max(Instant::now());
+                }
+                loop {
+                    next_slot += slot;
+                    sleep_until(next_slot);
+                    match to_banks.try_send(packet) {
+                        Ok(()) => break,
+                        Err(TrySendError::Full(p)) => packet = p,
+                        Err(TrySendError::Disconnected(_)) => return,
+                    }
+                }
+            }
+        });
+
+        // The firmware, with its own copy of the tile map's dirty flags
+        // so flushes take as long as they would.
+        let framed = transport.framed;
+        thread::spawn(move || {
+            let mut ep = EmulatedEndpoint { banks, packet: Vec::new(), pos: 0, waited: false };
+            let mut dirty = [false; 4 * TILE_COLS];
+            let mut stats = BridgeStats::default();
+            let mut busy_until = Instant::now();
+            while let Some(command) = ep.next() {
+                let mut read = 1;
+                let mut sent = 0;
+                let mut byte = |ep: &mut EmulatedEndpoint| {
+                    read += 1;
+                    ep.next().unwrap_or(0)
+                };
+                let mut reply = None;
+                match command {
+                    LINK_DATA => {
+                        let page = byte(&mut ep);
+                        let column = byte(&mut ep) as usize;
+                        let n = byte(&mut ep) as usize;
+                        for _ in 0..n {
+                            byte(&mut ep);
+                        }
+                        if page < 4 && column < 128 && n > 0 {
+                            sent = SPAN_SETUP + n.min(128 - column);
+                        }
+                    }
+                    LINK_TILES => {
+                        let first = byte(&mut ep) as usize;
+                        let n = byte(&mut ep) as usize;
+                        for i in 0..n {
+                            byte(&mut ep);
+                            if let Some(d) = dirty.get_mut(first + i) {
+                                *d = true;
+                            }
+                        }
+                    }
+                    LINK_FLUSH => {
+                        reply = Some(flush_command(byte(&mut ep)));
+                        sent = 8 * dirty.iter().filter(|&&d| d).count();
+                        dirty = [false; 4 * TILE_COLS];
+                    }
+                    LINK_DELTA => {
+                        let pos = (byte(&mut ep) as usize) << 8 | byte(&mut ep) as usize;
+                        let n = byte(&mut ep) as usize;
+                        let ops: Vec<u8> = (0..n).map(|_| byte(&mut ep)).collect();
+                        let spans = delta::decode(&ops, pos, &mut [0; 512]);
+                        sent = spans.iter().map(|&(_, len)| SPAN_SETUP + len).sum();
+                    }
+                    // Everything's acked.
+                    LINK_I2C => {
+                        byte(&mut ep);
+                        let flags = byte(&mut ep);
+                        let n = byte(&mut ep) as usize;
+                        for _ in 0..n {
+                            byte(&mut ep);
+                        }
+                        sent = n;
+                        if flags & I2C_START != 0 {
+                            sent += 1;
+                            stats.transactions += 1;
+                        }
+                        stats.bytes += sent as u32;
+                    }
+                    LINK_STATS => reply = Some(stats.to_reply(byte(&mut ep))),
+                    // As the firmware, which can't tell how long it is.
+                    _ => ep.end_packet(),
+                }
+                if framed {
+                    ep.end_packet();
+                }
+                if ep.waited {
+                    busy_until = busy_until.max(Instant::now());
+                    ep.waited = false;
+                }
+                busy_until += read_time * read + byte_time * sent as u32;
+                sleep_until(busy_until);
+                if let Some(reply) = reply {
+                    // The reply goes out on the next IN frame.
+                    sleep_until(busy_until + FRAME);
+                    if to_host.send(reply).is_err() {
+                        return;
+                    }
+                }
+            }
+        });
+
+        Emulated { transport, pending: Vec::new(), to_wire, replies }
+    }
+
+    fn flush(&mut self) {
+        let pending = std::mem::take(&mut self.pending);
+        for packet in pending.chunks(self.transport.packet_size) {
+            self.to_wire.send(packet.to_vec()).unwrap();
+        }
+    }
+}
+
+// Receives from "r", and says whether it had to wait.
+fn recv_noting_wait<T>(r: &Receiver<T>) -> Option<(T, bool)> {
+    match r.try_recv() {
+        Ok(x) => Some((x, false)),
+        Err(TryRecvError::Empty) => r.recv().ok().map(|x| (x, true)),
+        Err(TryRecvError::Disconnected) => None,
+    }
+}
+
+fn sleep_until(t: Instant) {
+    let now = Instant::now();
+    if t > now {
+        thread::sleep(t - now);
+    }
+}
+
+impl Link for Emulated {
+    fn command_len(&self) -> usize {
+        self.transport.command_len
+    }
+
+    fn send(&mut self, command: &[u8]) {
+        if self.transport.framed {
+            let mut packet = vec![0; self.transport.packet_size];
+            packet[..command.len()].copy_from_slice(command);
+            self.to_wire.send(packet).unwrap();
+        } else {
+            self.pending.extend_from_slice(command);
+            if self.pending.len() >= STREAM_CHUNK {
+                self.flush();
+            }
+        }
+    }
+
+    fn recv(&mut self) -> Vec<u8> {
+        self.flush();
+        self.replies.recv().unwrap()
+    }
+}
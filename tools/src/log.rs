@@ -0,0 +1,483 @@
+//
+// Tokenized logging: collecting LOG calls from the firmware's sources,
+// and turning the records it sends back into text. See log.h for the
+// firmware's side.
+//
+
+use std::collections::HashMap;
+use std::fs;
+use std::path::Path;
+
+pub const LOG_MARK: u8 = 0xff;
+// Bus mirror records (see MIRROR in teensy_oled.c).
+pub const MIRROR_MARK: u8 = 0xfe;
+
+// The types of argument a format can take, as on the AVR.
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub enum ArgType {
+    I8,
+    U8,
+    I16,
+    U16,
+    I32,
+    U32,
+    Char,
+    Float,
+}
+
+impl ArgType {
+    pub fn size(self) -> usize {
+        match self {
+            ArgType::I8 | ArgType::U8 | ArgType::Char => 1,
+            ArgType::I16 | ArgType::U16 => 2,
+            ArgType::I32 | ArgType::U32 | ArgType::Float => 4,
+        }
+    }
+
+    pub fn c_type(self) -> &'static str {
+        match self {
+            ArgType::I8 => "int8_t",
+            ArgType::U8 => "uint8_t",
+            ArgType::I16 => "int",
+            ArgType::U16 => "unsigned int",
+            ArgType::I32 => "long",
+            ArgType::U32 => "unsigned long",
+            ArgType::Char => "char",
+            ArgType::Float => "float",
+        }
+    }
+}
+
+// A format, split into text and conversions.
+#[derive(Debug)]
+pub enum Piece {
+    Text(String),
+    // The conversion's flags and width (and precision, for floats),
+    // its letter, and the argument it takes.
+    Conv { spec: String, letter: char, arg: ArgType },
+}
+
+pub fn parse_format(format: &str) -> Result<Vec<Piece>, String> {
+    let mut pieces = Vec::new();
+    let mut text = String::new();
+    let mut chars = format.chars().peekable();
+    while let Some(c) = chars.next() {
+        if c != '%' {
+            text.push(c);
+            continue;
+        }
+        if chars.peek() == Some(&'%') {
+            chars.next();
+            text.push('%');
+            continue;
+        }
+        let mut spec = String::new();
+        while let Some(&c) = chars.peek() {
+            if "-0+ #.".contains(c) || c.is_ascii_digit() {
+                spec.push(c);
+                chars.next();
+            } else {
+                break;
+            }
+        }
+        let mut length = String::new();
+        while let Some(&c) = chars.peek() {
+            if c == 'l' || c == 'h' {
+                length.push(c);
+                chars.next();
+            } else {
+                break;
+            }
+        }
+        let letter = chars.next().ok_or("Format ends in %")?;
+        let signed = letter == 'd' || letter == 'i';
+        let arg = match (letter, length.as_str()) {
+            ('d', "") | ('i', "") => ArgType::I16,
+            ('u', "") | ('x', "") | ('X', "") => ArgType::U16,
+            ('d', "l") | ('i', "l") => ArgType::I32,
+            ('u', "l") | ('x', "l") | ('X', "l") => ArgType::U32,
+            (_, "hh") if signed => ArgType::I8,
+            ('u', "hh") | ('x', "hh") | ('X', "hh") => ArgType::U8,
+            ('c', "") => ArgType::Char,
+            ('f', "") => ArgType::Float,
+            _ => return Err(format!("Unsupported conversion %{}{}", length, letter)),
+        };
+        if !text.is_empty() {
+            pieces.push(Piece::Text(std::mem::take(&mut text)));
+        }
+        pieces.push(Piece::Conv { spec, letter, arg });
+    }
+    if !text.is_empty() {
+        pieces.push(Piece::Text(text));
+    }
+    Ok(pieces)
+}
+
+// Formats "v" (as its bits, or a float's) for a conversion.
+fn format_conv(spec: &str, letter: char, arg: ArgType, bytes: &[u8]) -> String {
+    let mut raw = [0u8; 4];
+    raw[..bytes.len()].copy_from_slice(bytes);
+    let u = u32::from_le_bytes(raw);
+    let body = match arg {
+        ArgType::Float => {
+            let precision = spec.split('.').nth(1).and_then(|p| p.parse().ok()).unwrap_or(6);
+            format!("{:.*}", precision, f32::from_bits(u))
+        }
+        ArgType::Char => (bytes[0] as char).to_string(),
+        ArgType::I8 => (bytes[0] as i8).to_string(),
+        ArgType::I16 => (u as u16 as i16).to_string(),
+        ArgType::I32 => (u as i32).to_string(),
+        _ => match letter {
+            'x' => format!("{:x}", u),
+            'X' => format!("{:X}", u),
+            _ => u.to_string(),
+        },
+    };
+    let width: usize = spec
+        .split('.')
+        .next()
+        .unwrap()
+        .trim_start_matches(|c| "-0+ #".contains(c))
+        .parse()
+        .unwrap_or(0);
+    if body.len() >= width {
+        body
+    } else if spec.starts_with('-') {
+        format!("{:<1$}", body, width)
+    } else if spec.starts_with('0') && arg != ArgType::Char {
+        let (sign, digits) = if body.starts_with('-') { ("-", &body[1..]) } else { ("", &body[..]) };
+        format!("{}{:0>2$}", sign, digits, width - sign.len())
+    } else {
+        format!("{:>1$}", body, width)
+    }
+}
+
+pub struct Token {
+    pub id: u8,
+    pub name: String,
+    // As written in the source, escapes and all.
+    pub format: String,
+    pub pieces: Vec<Piece>,
+}
+
+impl Token {
+    pub fn args(&self) -> Vec<ArgType> {
+        self.pieces
+            .iter()
+            .filter_map(|p| match p {
+                Piece::Conv { arg, .. } => Some(*arg),
+                Piece::Text(_) => None,
+            })
+            .collect()
+    }
+
+    pub fn record_len(&self) -> usize {
+        2 + self.args().iter().map(|a| a.size()).sum::<usize>()
+    }
+
+    // What each argument's called, for formats of "name=%d" and so on:
+    // the word before it, or its position.
+    pub fn labels(&self) -> Vec<String> {
+        let mut labels = Vec::new();
+        let mut before = "";
+        for piece in self.pieces.iter() {
+            match piece {
+                Piece::Text(t) => before = t,
+                Piece::Conv { .. } => {
+                    let word = before.strip_suffix('=').and_then(|b| b.split_whitespace().last());
+                    labels.push(word.map_or_else(|| labels.len().to_string(), |w| w.to_string()));
+                    before = "";
+                }
+            }
+        }
+        labels
+    }
+
+    // The record's arguments as numbers.
+    pub fn values(&self, args: &[u8]) -> Vec<f64> {
+        let mut values = Vec::new();
+        let mut pos = 0;
+        for arg in self.args() {
+            let mut raw = [0u8; 4];
+            raw[..arg.size()].copy_from_slice(&args[pos..pos + arg.size()]);
+            let u = u32::from_le_bytes(raw);
+            values.push(match arg {
+                ArgType::I8 => u as u8 as i8 as f64,
+                ArgType::I16 => u as u16 as i16 as f64,
+                ArgType::I32 => u as i32 as f64,
+                ArgType::Float => f32::from_bits(u) as f64,
+                _ => u as f64,
+            });
+            pos += arg.size();
+        }
+        values
+    }
+
+    // Expands the record's arguments into text.
+    pub fn expand(&self, args: &[u8]) -> String {
+        let mut out = String::new();
+        let mut pos = 0;
+        for piece in self.pieces.iter() {
+            match piece {
+                Piece::Text(t) => out.push_str(t),
+                Piece::Conv { spec, letter, arg } => {
+                    out.push_str(&format_conv(spec, *letter, *arg, &args[pos..pos + arg.size()]));
+                    pos += arg.size();
+                }
+            }
+        }
+        out
+    }
+}
+
+// Undoes the escapes of a C string literal's contents.
+fn c_unescape(s: &str) -> String {
+    let mut out = String::new();
+    let mut chars = s.chars();
+    while let Some(c) = chars.next() {
+        if c != '\\' {
+            out.push(c);
+            continue;
+        }
+        match chars.next() {
+            Some('n') => out.push('\n'),
+            Some('t') => out.push('\t'),
+            Some('r') => out.push('\r'),
+            Some(c) => out.push(c),
+            None => (),
+        }
+    }
+    out
+}
+
+fn is_ident(c: char) -> bool {
+    c.is_ascii_alphanumeric() || c == '_'
+}
+
+// Finds each LOG(NAME, "format"...) in "source", giving the name and
+// the format as written (adjacent literals joined).
+pub fn scan(source: &str) -> Vec<(String, String)> {
+    let mut found = Vec::new();
+    let mut rest = source;
+    while let Some(i) = rest.find("LOG(") {
+        let before = rest[..i].chars().next_back();
+        rest = &rest[i + 4..];
+        if before.map_or(false, is_ident) {
+            continue;
+        }
+        let s = rest.trim_start();
+        let name_len = s.find(|c: char| !is_ident(c)).unwrap_or(s.len());
+        let name = &s[..name_len];
+        let mut s = s[name_len..].trim_start();
+        if name.is_empty() || !s.starts_with(',') {
+            continue;
+        }
+        s = s[1..].trim_start();
+        let mut format = String::new();
+        while s.starts_with('"') {
+            let mut end = 1;
+            let bytes = s.as_bytes();
+            while end < bytes.len() && bytes[end] != b'"' {
+                end += if bytes[end] == b'\\' { 2 } else { 1 };
+            }
+            format.push_str(&s[1..end]);
+            s = s[(end + 1).min(s.len())..].trim_start();
+        }
+        if !format.is_empty() {
+            found.push((name.to_string(), format));
+        }
+    }
+    found
+}
+
+pub struct Tokens {
+    pub tokens: Vec<Token>,
+}
+
+impl Tokens {
+    // Collects the LOGs from "files", numbering them from 1 in order.
+    // A name can be used more than once, but only with one format.
+    pub fn collect(files: &[String]) -> Tokens {
+        let mut tokens: Vec<Token> = Vec::new();
+        for file in files.iter() {
+            let source = fs::read_to_string(file).unwrap_or_else(|e| panic!("{}: {}", file, e));
+            for (name, format) in scan(&source) {
+                if let Some(t) = tokens.iter().find(|t| t.name == name) {
+                    assert_eq!(t.format, format, "{}: LOG {} with two formats", file, name);
+                    continue;
+                }
+                assert!(tokens.len() < LOG_MARK as usize - 1, "Too many LOG tokens");
+                let pieces = parse_format(&c_unescape(&format))
+                    .unwrap_or_else(|e| panic!("{}: LOG {}: {}", file, name, e));
+                tokens.push(Token { id: tokens.len() as u8 + 1, name, format, pieces });
+            }
+        }
+        Tokens { tokens }
+    }
+
+    // As lines of id, name and format, tab-separated.
+    pub fn write_table(&self, file_name: &Path) {
+        let table: String = self
+            .tokens
+            .iter()
+            .map(|t| format!("{}\t{}\t{}\n", t.id, t.name, t.format))
+            .collect();
+        fs::write(file_name, table).unwrap();
+    }
+
+    pub fn read_table(file_name: &Path) -> Tokens {
+        let table = fs::read_to_string(file_name).unwrap_or_else(|e| panic!("{}: {}", file_name.display(), e));
+        let tokens = table
+            .lines()
+            .map(|line| {
+                let mut fields = line.splitn(3, '\t');
+                let id = fields.next().unwrap().parse().expect("Bad token ID");
+                let name = fields.next().expect("Missing name").to_string();
+                let format = fields.next().expect("Missing format").to_string();
+                let pieces = parse_format(&c_unescape(&format)).unwrap();
+                Token { id, name, format, pieces }
+            })
+            .collect();
+        Tokens { tokens }
+    }
+
+    // The header: each token's ID, and a function to send its record.
+    pub fn write_header(&self) {
+        println!("// Log tokens, collected from LOG calls by log2teensy.");
+        println!("// See log.h.");
+        for t in self.tokens.iter() {
+            let args = t.args();
+            let params: Vec<String> =
+                args.iter().enumerate().map(|(i, a)| format!("{} a{}", a.c_type(), i)).collect();
+            println!();
+            println!("#define LOG_ID_{} {}", t.name, t.id);
+            println!("// \"{}\"", t.format);
+            println!(
+                "static inline void log_{}({})",
+                t.name,
+                if params.is_empty() { "void".to_string() } else { params.join(", ") }
+            );
+            println!("{{");
+            println!("    struct __attribute__((packed)) {{");
+            println!("        uint8_t mark, id;");
+            for (i, a) in args.iter().enumerate() {
+                println!("        {} a{};", a.c_type(), i);
+            }
+            let values: String = (0..args.len()).map(|i| format!(", a{}", i)).collect();
+            println!("    }} r = {{ LOG_MARK, LOG_ID_{}{} }};", t.name, values);
+            println!("    usb_debug_write((const uint8_t *)&r, sizeof(r));");
+            println!("}}");
+        }
+    }
+}
+
+// What comes over the debug channel: text, a record of a token's
+// arguments, or a chunk of a bus transaction, with its sequence number
+// and whether it starts the transaction.
+pub enum Item {
+    Text(String),
+    Record(u8, Vec<u8>),
+    Mirror { first: bool, seq: u8, bytes: Vec<u8> },
+}
+
+// Splits what comes over the debug channel into text and records.
+// Records can straddle reports.
+pub struct Decoder {
+    tokens: HashMap<u8, Token>,
+    pending: Vec<u8>,
+}
+
+impl Decoder {
+    pub fn new(tokens: Tokens) -> Decoder {
+        Decoder {
+            tokens: tokens.tokens.into_iter().map(|t| (t.id, t)).collect(),
+            pending: Vec::new(),
+        }
+    }
+
+    pub fn token(&self, id: u8) -> &Token {
+        &self.tokens[&id]
+    }
+
+    pub fn token_named(&self, name: &str) -> Option<&Token> {
+        self.tokens.values().find(|t| t.name == name)
+    }
+
+    // Returns what "bytes" completes. Unknown tokens come out as text.
+    pub fn items(&mut self, bytes: &[u8]) -> Vec<Item> {
+        self.pending.extend_from_slice(bytes);
+        let mut items = Vec::new();
+        let mut text = Vec::new();
+        let mut i = 0;
+        while i < self.pending.len() {
+            let b = self.pending[i];
+            if b == MIRROR_MARK {
+                let header = match self.pending.get(i + 1) {
+                    Some(&h) => h,
+                    None => break,
+                };
+                let len = 3 + (header & 0x7f) as usize;
+                if self.pending.len() < i + len {
+                    break;
+                }
+                if !text.is_empty() {
+                    items.push(Item::Text(String::from_utf8_lossy(&text).into_owned()));
+                    text.clear();
+                }
+                items.push(Item::Mirror {
+                    first: header & 0x80 != 0,
+                    seq: self.pending[i + 2],
+                    bytes: self.pending[i + 3..i + len].to_vec(),
+                });
+                i += len;
+                continue;
+            }
+            if b != LOG_MARK {
+                // Zeros pad out partly filled reports.
+                if b != 0 && b != b'\r' {
+                    text.push(b);
+                }
+                i += 1;
+                continue;
+            }
+            let id = match self.pending.get(i + 1) {
+                Some(&id) => id,
+                None => break,
+            };
+            let len = match self.tokens.get(&id) {
+                Some(t) => t.record_len(),
+                None => {
+                    text.extend_from_slice(format!("<unknown token {}>\n", id).as_bytes());
+                    i += 2;
+                    continue;
+                }
+            };
+            if self.pending.len() < i + len {
+                break;
+            }
+            if !text.is_empty() {
+                items.push(Item::Text(String::from_utf8_lossy(&text).into_owned()));
+                text.clear();
+            }
+            items.push(Item::Record(id, self.pending[i + 2..i + len].to_vec()));
+            i += len;
+        }
+        if !text.is_empty() {
+            items.push(Item::Text(String::from_utf8_lossy(&text).into_owned()));
+        }
+        self.pending.drain(..i);
+        items
+    }
+
+    // Returns the text for "bytes", as far as it can be decoded.
+    pub fn feed(&mut self, bytes: &[u8]) -> String {
+        self.items(bytes)
+            .into_iter()
+            .map(|item| match item {
+                Item::Text(t) => t,
+                Item::Record(id, args) => self.token(id).expand(&args),
+                Item::Mirror { .. } => String::new(),
+            })
+            .collect()
+    }
+}
@@ -2,47 +2,68 @@
 // image2teensy: Quick, hacky tool to convert a png to a bitmap usable
 // on an SSD 1780 display.
 //
+// With --grey, the image is quantised to four grey levels, and output
+// in flash as two bitplanes for the greyscale mode: all the pages of
+// the low plane, then all those of the high plane.
+//
+// Usage: image2teensy [--grey] <image.png>
+//
 
 use std::env;
 use std::path::Path;
-use std::fs::File;
 
-fn main() {
-    let mut args = env::args();
-    assert_eq!(args.len(), 2);
-    let file_name_str = args.nth(1).unwrap();
-    let file_name = Path::new(&file_name_str);
+use image2teensy::{load_png, print_bytes, to_pages, Image};
+
+const GREY_PLANES: u32 = 2;
+
+// The image as one plane of "planes", with each pixel quantised to one
+// of 2^planes levels, and white where bit "plane" of its level is set.
+fn bitplane(image: &Image, planes: u32, plane: u32) -> Image {
+    let max_level = (1 << planes) - 1;
+    let pixels = image
+        .pixels
+        .iter()
+        .map(|&p| {
+            let level = (p as u32 * max_level + 0x7f) / 0xff;
+            if level & (1 << plane) != 0 { 0xff } else { 0x00 }
+        })
+        .collect();
+    Image {
+        width: image.width,
+        height: image.height,
+        pixels,
+    }
+}
 
-    let decoder = png::Decoder::new(File::open(file_name).unwrap());
-    let (info, mut reader) = decoder.read_info().unwrap();
-    // Allocate the output buffer.
-    let mut buf = vec![0; info.buffer_size()];
-    // Read the next frame. An APNG might contain multiple frames.
-    reader.next_frame(&mut buf).unwrap();
+fn main() {
+    let args: Vec<String> = env::args().skip(1).collect();
+    let (grey, file_name_str) = match args.as_slice() {
+        [name] => (false, name),
+        [flag, name] if flag == "--grey" => (true, name),
+        _ => panic!("Usage: image2teensy [--grey] <image.png>"),
+    };
+    let file_name = Path::new(file_name_str);
 
-    assert_eq!(info.color_type, png::ColorType::Grayscale);
-    assert_eq!(info.bit_depth, png::BitDepth::Eight);
+    let image = load_png(file_name);
 
     let stem = file_name.file_stem().unwrap().to_str().unwrap();
-    println!("static const char {}[] = {{", stem);
-
-    // Break image apart into 8 pixel rows, record each 8-bit column.
-    let w = info.width;
-    let h = info.height;
-    for y_page in 0..(h + 7)/8 {
-        print!("    ");
-        for x in 0..w {
-            let mut c: u8 = 0;
-            for y in 0..8 {
-                let y_total = y_page * 8 + y;
-                if y_total < h && buf[(y_total * w + x) as usize] >= 0x80 {
-                    c |= 1 << y;
-                }
-            }
-            print!("0x{:02x}, ", c);
+    if !grey {
+        println!("static const char {}[] = {{", stem);
+        for page in to_pages(&image).iter() {
+            print_bytes(page);
+            println!();
         }
-        println!();
+        println!("}};");
+        return;
     }
 
+    println!("static const char {}[] PROGMEM = {{", stem);
+    for plane in 0..GREY_PLANES {
+        println!("    // Plane {}", plane);
+        for page in to_pages(&bitplane(&image, GREY_PLANES, plane)).iter() {
+            print_bytes(page);
+            println!();
+        }
+    }
     println!("}};");
 }
@@ -0,0 +1,260 @@
+//
+// An SSD1306 as seen from the bus: it follows the commands and data
+// the firmware sends (see MIRROR in teensy_oled.c), so it knows what
+// the panel shows.
+//
+
+pub const WIDTH: usize = 128;
+pub const HEIGHT: usize = 32;
+// The controller has RAM for 64 rows, of which the panel shows 32.
+const PAGES: usize = 8;
+
+// I2C addresses of the display, either way its address pin is set.
+pub const OLED_ADDRS: [u8; 2] = [0x78, 0x7a];
+
+const MODE_HORIZONTAL: u8 = 0;
+const MODE_VERTICAL: u8 = 1;
+const MODE_PAGE: u8 = 2;
+
+// How many parameter bytes follow each command.
+fn params(cmd: u8) -> usize {
+    match cmd {
+        0x20 | 0x81 | 0x8d | 0xa8 | 0xd3 | 0xd5 | 0xd9 | 0xda | 0xdb => 1,
+        0x21 | 0x22 | 0xa3 => 2,
+        0x29 | 0x2a => 5,
+        0x26 | 0x27 => 6,
+        0x2c | 0x2d => 7,
+        _ => 0,
+    }
+}
+
+pub struct Ssd1306 {
+    // By segment and page, as stored: remapping applies as data's
+    // written, but the COM direction as it's shown.
+    ram: [[u8; WIDTH]; PAGES],
+    // The panel's quirks: setting the upper column nibble clears the
+    // lower one, and a column range starts at its start & 0xf0 (see
+    // oled_blit). The datasheet says neither happens.
+    quirks: bool,
+    mode: u8,
+    col: usize,
+    page: usize,
+    col_start: usize,
+    col_end: usize,
+    page_start: usize,
+    page_end: usize,
+    seg_remap: bool,
+    com_flip: bool,
+    start_line: usize,
+    pub contrast: u8,
+    pub inverted: bool,
+    pub entire_on: bool,
+    pub display_on: bool,
+    // Where in a transaction we are: before the control byte, or in
+    // commands or data, and if the control byte only covers one.
+    control: bool,
+    data: bool,
+    single: bool,
+    command: Vec<u8>,
+}
+
+impl Ssd1306 {
+    // As after reset.
+    pub fn new(quirks: bool) -> Ssd1306 {
+        Ssd1306 {
+            ram: [[0; WIDTH]; PAGES],
+            quirks,
+            mode: MODE_PAGE,
+            col: 0,
+            page: 0,
+            col_start: 0,
+            col_end: WIDTH - 1,
+            page_start: 0,
+            page_end: PAGES - 1,
+            seg_remap: false,
+            com_flip: false,
+            start_line: 0,
+            contrast: 0x7f,
+            inverted: false,
+            entire_on: false,
+            display_on: false,
+            control: true,
+            data: false,
+            single: false,
+            command: Vec::new(),
+        }
+    }
+
+    // Starts a transaction, after its address.
+    pub fn start(&mut self) {
+        self.control = true;
+        self.command.clear();
+    }
+
+    // The next byte of a transaction.
+    pub fn byte(&mut self, b: u8) {
+        if self.control {
+            // Co, then D/C#.
+            self.single = b & 0x80 != 0;
+            self.data = b & 0x40 != 0;
+            self.control = false;
+            return;
+        }
+        if self.data {
+            self.write(b);
+        } else {
+            self.command.push(b);
+            if self.command.len() > params(self.command[0]) {
+                let command = std::mem::take(&mut self.command);
+                self.execute(&command);
+            }
+        }
+        if self.single {
+            self.control = true;
+        }
+    }
+
+    fn write(&mut self, b: u8) {
+        let seg = if self.seg_remap { WIDTH - 1 - self.col } else { self.col };
+        self.ram[self.page][seg] = b;
+        match self.mode {
+            MODE_HORIZONTAL => {
+                if self.col >= self.col_end {
+                    self.col = self.col_start;
+                    self.page = if self.page >= self.page_end { self.page_start } else { self.page + 1 };
+                } else {
+                    self.col += 1;
+                }
+            }
+            MODE_VERTICAL => {
+                if self.page >= self.page_end {
+                    self.page = self.page_start;
+                    self.col = if self.col >= self.col_end { self.col_start } else { self.col + 1 };
+                } else {
+                    self.page += 1;
+                }
+            }
+            _ => self.col = if self.col >= self.col_end { self.col_start } else { self.col + 1 },
+        }
+    }
+
+    fn execute(&mut self, c: &[u8]) {
+        let limit = |v: u8, n: usize| v as usize % n;
+        match c[0] {
+            0x00..=0x0f => self.col = (self.col & 0x70) | (c[0] & 0x0f) as usize,
+            0x10..=0x17 => {
+                let low = if self.quirks { 0 } else { self.col & 0x0f };
+                self.col = ((c[0] & 0x07) as usize) << 4 | low;
+            }
+            0x20 => self.mode = c[1] & 3,
+            0x21 => {
+                self.col_start = limit(c[1], WIDTH);
+                self.col_end = limit(c[2], WIDTH);
+                self.col = if self.quirks { self.col_start & 0x70 } else { self.col_start };
+            }
+            0x22 => {
+                self.page_start = limit(c[1], PAGES);
+                self.page_end = limit(c[2], PAGES);
+                self.page = self.page_start;
+            }
+            // One column scrolls: pages c[2] to c[4], columns c[6] to
+            // c[7], left (0x2d) or right (0x2c), as the columns are
+            // addressed.
+            0x2c | 0x2d => {
+                let (mut first, mut last) = (limit(c[6], WIDTH), limit(c[7], WIDTH));
+                if self.seg_remap {
+                    let (a, b) = (WIDTH - 1 - last, WIDTH - 1 - first);
+                    first = a;
+                    last = b;
+                }
+                for page in limit(c[2], PAGES)..=limit(c[4], PAGES) {
+                    if first < last {
+                        let row = &mut self.ram[page][first..=last];
+                        if (c[0] == 0x2d) != self.seg_remap {
+                            row.rotate_left(1);
+                        } else {
+                            row.rotate_right(1);
+                        }
+                    }
+                }
+            }
+            0x40..=0x7f => self.start_line = (c[0] & 0x3f) as usize,
+            0x81 => self.contrast = c[1],
+            0xa0 | 0xa1 => self.seg_remap = c[0] & 1 != 0,
+            0xa4 | 0xa5 => self.entire_on = c[0] & 1 != 0,
+            0xa6 | 0xa7 => self.inverted = c[0] & 1 != 0,
+            0xae | 0xaf => self.display_on = c[0] & 1 != 0,
+            0xb0..=0xb7 => self.page = (c[0] & 7) as usize,
+            0xc0..=0xcf => self.com_flip = c[0] & 8 != 0,
+            // Timing, power and scrolling set-up don't change the image.
+            _ => (),
+        }
+    }
+
+    // Whether the pixel at (x, y) of the panel is lit.
+    pub fn pixel(&self, x: usize, y: usize) -> bool {
+        if !self.display_on {
+            return false;
+        }
+        if self.entire_on {
+            return true;
+        }
+        let com = if self.com_flip { HEIGHT - 1 - y } else { y };
+        let row = (com + self.start_line) % (PAGES * 8);
+        let lit = self.ram[row / 8][x] & (1 << (row % 8)) != 0;
+        lit != self.inverted
+    }
+}
+
+// Follows the mirror records from the firmware, skipping the rest of a
+// transaction when a record's been lost.
+pub struct Mirror {
+    pub panel: Ssd1306,
+    next_seq: Option<u8>,
+    // Whether the transaction under way is to the display, and all of
+    // it's arrived.
+    following: bool,
+    pub records: u64,
+    pub lost: u64,
+    pub transactions: u64,
+}
+
+impl Mirror {
+    pub fn new(quirks: bool) -> Mirror {
+        Mirror {
+            panel: Ssd1306::new(quirks),
+            next_seq: None,
+            following: false,
+            records: 0,
+            lost: 0,
+            transactions: 0,
+        }
+    }
+
+    pub fn record(&mut self, first: bool, seq: u8, bytes: &[u8]) {
+        if let Some(next) = self.next_seq {
+            if seq != next {
+                self.lost += seq.wrapping_sub(next) as u64;
+                self.following = false;
+            }
+        }
+        self.next_seq = Some(seq.wrapping_add(1));
+        self.records += 1;
+
+        let mut bytes = bytes;
+        if first {
+            // The address, with the write bit clear.
+            self.following = !bytes.is_empty() && OLED_ADDRS.contains(&bytes[0]);
+            if self.following {
+                self.transactions += 1;
+                self.panel.start();
+            }
+            bytes = &bytes[bytes.len().min(1)..];
+        }
+        if self.following {
+            for &b in bytes.iter() {
+                self.panel.byte(b);
+            }
+        }
+    }
+}
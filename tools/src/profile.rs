@@ -0,0 +1,162 @@
+//
+// The firmware's sampling profiler (see profile.h): its histogram,
+// and the functions its buckets cover, from the ELF file.
+//
+
+use std::fs;
+use std::path::Path;
+
+////////////////////////////////////////////////////////////////////////
+// Histogram
+//
+
+// As in profile.h, with counts totalled over many reports.
+#[derive(Clone)]
+pub struct Profile {
+    pub lo: u32,
+    pub shift: u8,
+    pub blocked: u64,
+    pub outside: u64,
+    pub counts: Vec<u64>,
+}
+
+fn u16_at(bytes: &[u8], i: usize) -> u64 {
+    u16::from_le_bytes([bytes[i], bytes[i + 1]]) as u64
+}
+
+impl Profile {
+    pub fn from_report(report: &[u8]) -> Profile {
+        assert!(report.len() >= 8, "Short profile report");
+        let buckets = report[3] as usize;
+        assert!(report.len() >= 8 + 2 * buckets, "Short profile report");
+        Profile {
+            lo: u16_at(report, 0) as u32,
+            shift: report[2],
+            blocked: u16_at(report, 4),
+            outside: u16_at(report, 6),
+            counts: (0..buckets).map(|i| u16_at(report, 8 + 2 * i)).collect(),
+        }
+    }
+
+    // An empty profile, laid out like "p".
+    pub fn empty(p: &Profile) -> Profile {
+        Profile { blocked: 0, outside: 0, counts: vec![0; p.counts.len()], ..*p }
+    }
+
+    // Adds the samples between two reports. The firmware's counts wrap
+    // at 16 bits.
+    pub fn add_since(&mut self, now: &Profile, then: &Profile) {
+        let since = |a: u64, b: u64| (a as u16).wrapping_sub(b as u16) as u64;
+        self.blocked += since(now.blocked, then.blocked);
+        self.outside += since(now.outside, then.outside);
+        for (i, count) in self.counts.iter_mut().enumerate() {
+            *count += since(now.counts[i], then.counts[i]);
+        }
+    }
+
+    pub fn total(&self) -> u64 {
+        self.blocked + self.outside + self.counts.iter().sum::<u64>()
+    }
+
+    // The byte addresses of bucket "i".
+    pub fn bucket(&self, i: usize) -> (u32, u32) {
+        let start = self.lo + ((i as u32) << self.shift);
+        (start, start + (1 << self.shift))
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Symbols
+//
+
+pub struct Symbol {
+    pub name: String,
+    pub addr: u32,
+    pub size: u32,
+}
+
+const SHT_SYMTAB: u32 = 2;
+const STT_FUNC: u8 = 2;
+// Where the AVR toolchain puts RAM, above flash.
+const DATA_BASE: u32 = 0x800000;
+
+fn u32_at(bytes: &[u8], i: usize) -> u32 {
+    u32::from_le_bytes([bytes[i], bytes[i + 1], bytes[i + 2], bytes[i + 3]])
+}
+
+fn c_str(bytes: &[u8], i: usize) -> String {
+    let end = bytes[i..].iter().position(|&b| b == 0).map_or(bytes.len(), |n| i + n);
+    String::from_utf8_lossy(&bytes[i..end]).into_owned()
+}
+
+// The functions in a 32-bit little-endian ELF file's symbol table,
+// in order of address.
+pub fn read_symbols(path: &Path) -> Vec<Symbol> {
+    let elf = fs::read(path).unwrap_or_else(|e| panic!("{}: {}", path.display(), e));
+    assert!(elf.starts_with(b"\x7fELF\x01\x01"), "{}: Not a 32-bit little-endian ELF file", path.display());
+    let shoff = u32_at(&elf, 0x20) as usize;
+    let shentsize = u16_at(&elf, 0x2e) as usize;
+    let shnum = u16_at(&elf, 0x30) as usize;
+    let section = |i: usize| &elf[shoff + i * shentsize..shoff + (i + 1) * shentsize];
+
+    let mut symbols = Vec::new();
+    for i in 0..shnum {
+        let sh = section(i);
+        if u32_at(sh, 4) != SHT_SYMTAB {
+            continue;
+        }
+        let (offset, size) = (u32_at(sh, 16) as usize, u32_at(sh, 20) as usize);
+        let strtab = section(u32_at(sh, 24) as usize);
+        let strings = &elf[u32_at(strtab, 16) as usize..][..u32_at(strtab, 20) as usize];
+        for sym in elf[offset..offset + size].chunks(16) {
+            let (addr, size) = (u32_at(sym, 4), u32_at(sym, 8));
+            if sym[12] & 0xf == STT_FUNC && size > 0 && addr < DATA_BASE {
+                symbols.push(Symbol { name: c_str(strings, u32_at(sym, 0) as usize), addr, size });
+            }
+        }
+    }
+    symbols.sort_by_key(|s| s.addr);
+    // Aliases would count twice.
+    symbols.dedup_by_key(|s| s.addr);
+    symbols
+}
+
+// Shares each bucket's samples between the functions it covers, by how
+// many of its bytes each has. Those not in any function go to "".
+pub fn attribute(profile: &Profile, symbols: &[Symbol]) -> Vec<(String, f64)> {
+    let mut totals: Vec<(String, f64)> = Vec::new();
+    let mut add = |name: &str, n: f64| match totals.iter_mut().find(|t| t.0 == name) {
+        Some(t) => t.1 += n,
+        None => totals.push((name.to_string(), n)),
+    };
+    for (i, &count) in profile.counts.iter().enumerate() {
+        if count == 0 {
+            continue;
+        }
+        let (start, end) = profile.bucket(i);
+        let per_byte = count as f64 / (end - start) as f64;
+        let mut covered = 0;
+        for s in symbols.iter() {
+            let overlap = (end.min(s.addr + s.size)).saturating_sub(start.max(s.addr));
+            if overlap > 0 {
+                add(&s.name, overlap as f64 * per_byte);
+                covered += overlap;
+            }
+        }
+        if covered < end - start {
+            add("", (end - start - covered) as f64 * per_byte);
+        }
+    }
+    totals.sort_by(|a, b| b.1.partial_cmp(&a.1).unwrap());
+    totals
+}
+
+// The names of the functions bucket "i" covers.
+pub fn bucket_functions(profile: &Profile, symbols: &[Symbol], i: usize) -> Vec<String> {
+    let (start, end) = profile.bucket(i);
+    symbols
+        .iter()
+        .filter(|s| s.addr < end && s.addr + s.size > start)
+        .map(|s| s.name.clone())
+        .collect()
+}
@@ -26,6 +26,9 @@
 
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "usb_debug_only.h"
+#ifdef PROFILE
+#include "profile.h"
+#endif
 
 /**************************************************************************
  *
@@ -46,6 +49,11 @@
 #define VENDOR_ID		0x16C0
 #define PRODUCT_ID		0x0479
 
+// The raw HID interface, for the host to send display data, is found
+// by this usage page and usage.
+#define RAWHID_USAGE_PAGE	0xFFAB
+#define RAWHID_USAGE		0x0200
+
 
 // USB devices are supposed to implment a halt feature, which is
 // rarely (if ever) used.  If you comment this line out, the halt
@@ -72,11 +80,46 @@
 #define DEBUG_TX_SIZE		32
 #define DEBUG_TX_BUFFER		EP_DOUBLE_BUFFER
 
+// Debug output is buffered in RAM, and moved to the endpoint at each
+// start of frame, so printing never waits for the host.  A power of
+// two, up to 256.  Output beyond what fits is dropped and counted.
+#ifndef DEBUG_RING_SIZE
+#define DEBUG_RING_SIZE		128
+#endif
+
+// The raw HID receive endpoint is double buffered, so the host can send
+// the next report while we're still forwarding the last to the display.
+#define RAWHID_TX_ENDPOINT	1
+#define RAWHID_TX_SIZE		RAWHID_SIZE
+#define RAWHID_TX_BUFFER	EP_SINGLE_BUFFER
+#define RAWHID_TX_INTERVAL	1
+#define RAWHID_RX_ENDPOINT	2
+#define RAWHID_RX_SIZE		RAWHID_SIZE
+#define RAWHID_RX_BUFFER	EP_DOUBLE_BUFFER
+#define RAWHID_RX_INTERVAL	1
+
+// With BULK_LINK, a vendor-specific interface with a pair of bulk
+// endpoints carries the same commands as a byte stream. Bulk packets
+// aren't limited to one per frame, so the receive endpoint is double
+// buffered for the host to keep it full.
+#define BULK_RX_ENDPOINT	4
+#define BULK_RX_SIZE		BULK_SIZE
+#define BULK_RX_BUFFER		EP_DOUBLE_BUFFER
+#define BULK_TX_ENDPOINT	5
+#define BULK_TX_SIZE		16
+#define BULK_TX_BUFFER		EP_SINGLE_BUFFER
+
 static const uint8_t PROGMEM endpoint_config_table[] = {
-	0,
-	0,
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(RAWHID_TX_SIZE) | RAWHID_TX_BUFFER,
+	1, EP_TYPE_INTERRUPT_OUT, EP_SIZE(RAWHID_RX_SIZE) | RAWHID_RX_BUFFER,
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(DEBUG_TX_SIZE) | DEBUG_TX_BUFFER,
+#ifdef BULK_LINK
+	1, EP_TYPE_BULK_OUT,      EP_SIZE(BULK_RX_SIZE) | BULK_RX_BUFFER,
+	1, EP_TYPE_BULK_IN,       EP_SIZE(BULK_TX_SIZE) | BULK_TX_BUFFER
+#else
+	0,
 	0
+#endif
 };
 
 
@@ -120,18 +163,46 @@ static const uint8_t PROGMEM hid_report_descriptor[] = {
 	0x95, DEBUG_TX_SIZE,			// report count
 	0x09, 0x75,				// usage
 	0x81, 0x02,				// Input (array)
+#ifdef PROFILE
+	0x96, LSB(sizeof(struct profile)), MSB(sizeof(struct profile)), // report count
+	0x09, 0x76,				// usage
+	0xB1, 0x02,				// Feature (array)
+#endif
+	0xC0					// end collection
+};
+
+static const uint8_t PROGMEM rawhid_report_descriptor[] = {
+	0x06, LSB(RAWHID_USAGE_PAGE), MSB(RAWHID_USAGE_PAGE),
+	0x0A, LSB(RAWHID_USAGE), MSB(RAWHID_USAGE),
+	0xA1, 0x01,				// Collection 0x01
+	0x75, 0x08,				// report size = 8 bits
+	0x15, 0x00,				// logical minimum = 0
+	0x26, 0xFF, 0x00,			// logical maximum = 255
+	0x95, RAWHID_TX_SIZE,			// report count
+	0x09, 0x01,				// usage
+	0x81, 0x02,				// Input (array)
+	0x95, RAWHID_RX_SIZE,			// report count
+	0x09, 0x02,				// usage
+	0x91, 0x02,				// Output (array)
 	0xC0					// end collection
 };
 
-#define CONFIG1_DESC_SIZE (9+9+9+7)
+#ifdef BULK_LINK
+#define NUM_INTERFACES    3
+#define CONFIG1_DESC_SIZE (9+9+9+7 + 9+9+7+7 + 9+7+7)
+#else
+#define NUM_INTERFACES    2
+#define CONFIG1_DESC_SIZE (9+9+9+7 + 9+9+7+7)
+#endif
 #define HID_DESC2_OFFSET  (9+9)
+#define RAWHID_HID_DESC2_OFFSET (9+9+9+7+9)
 static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	// configuration descriptor, USB spec 9.6.3, page 264-266, Table 9-10
 	9, 					// bLength;
 	2,					// bDescriptorType;
 	LSB(CONFIG1_DESC_SIZE),			// wTotalLength
 	MSB(CONFIG1_DESC_SIZE),
-	1,					// bNumInterfaces
+	NUM_INTERFACES,				// bNumInterfaces
 	1,					// bConfigurationValue
 	0,					// iConfiguration
 	0xC0,					// bmAttributes
@@ -161,7 +232,66 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 	DEBUG_TX_ENDPOINT | 0x80,		// bEndpointAddress
 	0x03,					// bmAttributes (0x03=intr)
 	DEBUG_TX_SIZE, 0,			// wMaxPacketSize
-	1					// bInterval
+	1,					// bInterval
+	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+	9,					// bLength
+	4,					// bDescriptorType
+	1,					// bInterfaceNumber
+	0,					// bAlternateSetting
+	2,					// bNumEndpoints
+	0x03,					// bInterfaceClass (0x03 = HID)
+	0x00,					// bInterfaceSubClass
+	0x00,					// bInterfaceProtocol
+	0,					// iInterface
+	// HID interface descriptor, HID 1.11 spec, section 6.2.1
+	9,					// bLength
+	0x21,					// bDescriptorType
+	0x11, 0x01,				// bcdHID
+	0,					// bCountryCode
+	1,					// bNumDescriptors
+	0x22,					// bDescriptorType
+	sizeof(rawhid_report_descriptor),	// wDescriptorLength
+	0,
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	RAWHID_TX_ENDPOINT | 0x80,		// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	RAWHID_TX_SIZE, 0,			// wMaxPacketSize
+	RAWHID_TX_INTERVAL,			// bInterval
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	RAWHID_RX_ENDPOINT,			// bEndpointAddress
+	0x03,					// bmAttributes (0x03=intr)
+	RAWHID_RX_SIZE, 0,			// wMaxPacketSize
+	RAWHID_RX_INTERVAL,			// bInterval
+#ifdef BULK_LINK
+	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+	9,					// bLength
+	4,					// bDescriptorType
+	2,					// bInterfaceNumber
+	0,					// bAlternateSetting
+	2,					// bNumEndpoints
+	0xFF,					// bInterfaceClass (0xFF = vendor)
+	0x00,					// bInterfaceSubClass
+	0x00,					// bInterfaceProtocol
+	0,					// iInterface
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	BULK_RX_ENDPOINT,			// bEndpointAddress
+	0x02,					// bmAttributes (0x02=bulk)
+	BULK_RX_SIZE, 0,			// wMaxPacketSize
+	0,					// bInterval
+	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+	7,					// bLength
+	5,					// bDescriptorType
+	BULK_TX_ENDPOINT | 0x80,		// bEndpointAddress
+	0x02,					// bmAttributes (0x02=bulk)
+	BULK_TX_SIZE, 0,			// wMaxPacketSize
+	0					// bInterval
+#endif
 };
 
 // If you're desperate for a little extra code memory, these strings
@@ -200,6 +330,8 @@ static const struct descriptor_list_struct {
 	{0x0200, 0x0000, config1_descriptor, sizeof(config1_descriptor)},
 	{0x2200, 0x0000, hid_report_descriptor, sizeof(hid_report_descriptor)},
 	{0x2100, 0x0000, config1_descriptor+HID_DESC2_OFFSET, 9},
+	{0x2200, 0x0001, rawhid_report_descriptor, sizeof(rawhid_report_descriptor)},
+	{0x2100, 0x0001, config1_descriptor+RAWHID_HID_DESC2_OFFSET, 9},
 	{0x0300, 0x0000, (const uint8_t *)&string0, 4},
 	{0x0301, 0x0409, (const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
 	{0x0302, 0x0409, (const uint8_t *)&string2, sizeof(STR_PRODUCT)}
@@ -216,9 +348,16 @@ static const struct descriptor_list_struct {
 // zero when we are not configured, non-zero when enumerated
 static volatile uint8_t usb_configuration=0;
 
-// the time remaining before we transmit any partially full
-// packet, or send a zero length packet.
-static volatile uint8_t debug_flush_timer=0;
+// debug output waiting for the endpoint: written at debug_head by
+// usb_debug_putchar, and read from debug_tail at each start of frame.
+static uint8_t debug_ring[DEBUG_RING_SIZE];
+static volatile uint8_t debug_head=0;
+static volatile uint8_t debug_tail=0;
+
+// bytes of debug output dropped because the buffer was full.
+static volatile uint16_t debug_dropped=0;
+
+static void debug_drain(void);
 
 
 /**************************************************************************
@@ -249,11 +388,12 @@ uint8_t usb_configured(void)
 	return usb_configuration;
 }
 
-// transmit a character.  0 returned on success, -1 on error
+// buffer a character, to be sent at the next start of frame.  Never
+// waits: if the buffer is full, the character is dropped and counted.
+// 0 returned on success, -1 on error
 int8_t usb_debug_putchar(uint8_t c)
 {
-	static uint8_t previous_timeout=0;
-	uint8_t timeout, intr_state;
+	uint8_t next, intr_state;
 
 	// if we're not online (enumerated and configured), error
 	if (!usb_configuration) return -1;
@@ -262,63 +402,215 @@ int8_t usb_debug_putchar(uint8_t c)
 	// even both in the same program!
 	intr_state = SREG;
 	cli();
-	UENUM = DEBUG_TX_ENDPOINT;
-	// if we gave up due to timeout before, don't wait again
-	if (previous_timeout) {
-		if (!(UEINTX & (1<<RWAL))) {
-			SREG = intr_state;
-			return -1;
-		}
-		previous_timeout = 0;
+	next = (debug_head + 1) & (DEBUG_RING_SIZE - 1);
+	if (next == debug_tail) {
+		debug_dropped++;
+		SREG = intr_state;
+		return -1;
+	}
+	debug_ring[debug_head] = c;
+	debug_head = next;
+	SREG = intr_state;
+	return 0;
+}
+
+// buffer "size" bytes to transmit, all or none: if they don't all
+// fit, they're dropped and counted, so a record is never sent in part.
+// 0 returned on success, -1 on error
+int8_t usb_debug_write(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t head, intr_state;
+
+	if (!usb_configuration) return -1;
+	intr_state = SREG;
+	cli();
+	head = debug_head;
+	if (((debug_tail - head - 1) & (DEBUG_RING_SIZE - 1)) < size) {
+		debug_dropped += size;
+		SREG = intr_state;
+		return -1;
+	}
+	while (size--) {
+		debug_ring[head] = *buffer++;
+		head = (head + 1) & (DEBUG_RING_SIZE - 1);
 	}
+	debug_head = head;
+	SREG = intr_state;
+	return 0;
+}
+
+// the number of bytes of debug output waiting to be sent
+uint8_t usb_debug_queued(void)
+{
+	return (debug_head - debug_tail) & (DEBUG_RING_SIZE - 1);
+}
+
+// the number of bytes of debug output dropped so far, because they
+// came faster than the host took them.
+uint16_t usb_debug_dropped(void)
+{
+	uint16_t n;
+	uint8_t intr_state;
+
+	intr_state = SREG;
+	cli();
+	n = debug_dropped;
+	SREG = intr_state;
+	return n;
+}
+
+
+// receive a raw HID report into buffer, if one has arrived.  Returns
+// the number of bytes received, 0 if there was nothing waiting, or -1
+// if not configured.  Doesn't wait, so the main loop can poll it.
+int8_t usb_rawhid_recv(uint8_t *buffer)
+{
+	uint8_t i, intr_state;
+
+	if (!usb_configuration) return -1;
+	intr_state = SREG;
+	cli();
+	UENUM = RAWHID_RX_ENDPOINT;
+	if (!(UEINTX & (1<<RWAL))) {
+		SREG = intr_state;
+		return 0;
+	}
+	// copy the report out, and release the bank straight away, so
+	// the host can fill it while the caller works on this one.
+	for (i = RAWHID_RX_SIZE; i; i--) {
+		*buffer++ = UEDATX;
+	}
+	UEINTX = 0x6B;
+	SREG = intr_state;
+	return RAWHID_RX_SIZE;
+}
+
+// send a raw HID report.  Returns the number of bytes sent, 0 on
+// timeout (in milliseconds), or -1 if not configured.
+int8_t usb_rawhid_send(const uint8_t *buffer, uint8_t timeout)
+{
+	uint8_t i, intr_state;
+
+	if (!usb_configuration) return -1;
+	intr_state = SREG;
+	cli();
+	UENUM = RAWHID_TX_ENDPOINT;
+	timeout = UDFNUML + timeout;
 	// wait for the FIFO to be ready to accept data
-	timeout = UDFNUML + 4;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
+	while (!(UEINTX & (1<<RWAL))) {
 		SREG = intr_state;
-		// have we waited too long?
-		if (UDFNUML == timeout) {
-			previous_timeout = 1;
-			return -1;
-		}
-		// has the USB gone offline?
+		if (UDFNUML == timeout) return 0;
 		if (!usb_configuration) return -1;
-		// get ready to try checking again
 		intr_state = SREG;
 		cli();
-		UENUM = DEBUG_TX_ENDPOINT;
+		UENUM = RAWHID_TX_ENDPOINT;
 	}
-	// actually write the byte into the FIFO
-	UEDATX = c;
-	// if this completed a packet, transmit it now!
-	if (!(UEINTX & (1<<RWAL))) {
-		UEINTX = 0x3A;
-		debug_flush_timer = 0;
-	} else {
-		debug_flush_timer = 2;
+	for (i = RAWHID_TX_SIZE; i; i--) {
+		UEDATX = *buffer++;
 	}
+	UEINTX = 0x3A;
 	SREG = intr_state;
-	return 0;
+	return RAWHID_TX_SIZE;
 }
 
+#ifdef BULK_LINK
+// number of bytes waiting in the bulk receive buffer.  Only counts
+// the bank being read, so more may be in the other one.
+uint8_t usb_bulk_available(void)
+{
+	uint8_t n=0, intr_state;
 
-// immediately transmit any buffered output.
-void usb_debug_flush_output(void)
+	intr_state = SREG;
+	cli();
+	if (usb_configuration) {
+		UENUM = BULK_RX_ENDPOINT;
+		n = UEBCLX;
+		// an empty packet still needs releasing
+		if (!n && (UEINTX & (1<<RXOUTI))) UEINTX = 0x6B;
+	}
+	SREG = intr_state;
+	return n;
+}
+
+// receive up to "size" bytes from the bulk endpoint, without
+// waiting.  Returns the number of bytes received, 0 if nothing has
+// arrived, or -1 if not configured.  Each bank is released as soon
+// as it's empty, so the host can refill it while the caller works
+// through what it's been given.
+int8_t usb_bulk_read(uint8_t *buffer, uint8_t size)
 {
-	uint8_t intr_state;
+	uint8_t i, n, intr_state;
 
+	if (!usb_configuration) return -1;
 	intr_state = SREG;
 	cli();
-	if (debug_flush_timer) {
-		UENUM = DEBUG_TX_ENDPOINT;
-		while ((UEINTX & (1<<RWAL))) {
-			UEDATX = 0;
-		}
-		UEINTX = 0x3A;
-		debug_flush_timer = 0;
+	UENUM = BULK_RX_ENDPOINT;
+	n = UEBCLX;
+	if (n > size) n = size;
+	for (i = n; i; i--) {
+		*buffer++ = UEDATX;
+	}
+	// release the bank once it's empty, including empty packets
+	if ((UEINTX & (1<<RXOUTI)) && !UEBCLX) UEINTX = 0x6B;
+	SREG = intr_state;
+	return n;
+}
+
+// send up to BULK_TX_SIZE bytes as a single packet.  Returns the
+// number of bytes sent, 0 on timeout (in milliseconds), or -1 if not
+// configured.
+int8_t usb_bulk_send(const uint8_t *buffer, uint8_t size, uint8_t timeout)
+{
+	uint8_t i, intr_state;
+
+	if (!usb_configuration) return -1;
+	if (size > BULK_TX_SIZE) size = BULK_TX_SIZE;
+	intr_state = SREG;
+	cli();
+	UENUM = BULK_TX_ENDPOINT;
+	timeout = UDFNUML + timeout;
+	// wait for the FIFO to be ready to accept data
+	while (!(UEINTX & (1<<RWAL))) {
+		SREG = intr_state;
+		if (UDFNUML == timeout) return 0;
+		if (!usb_configuration) return -1;
+		intr_state = SREG;
+		cli();
+		UENUM = BULK_TX_ENDPOINT;
+	}
+	for (i = size; i; i--) {
+		UEDATX = *buffer++;
 	}
+	UEINTX = 0x3A;
 	SREG = intr_state;
+	return size;
+}
+#endif
+
+
+// transmit all buffered output now, waiting for room in the
+// endpoint if need be, unless the host stops taking it.  Don't call
+// with interrupts disabled.
+void usb_debug_flush_output(void)
+{
+	uint8_t intr_state, tail, timeout;
+
+	tail = debug_tail;
+	timeout = UDFNUML + 4;
+	while (usb_configuration) {
+		intr_state = SREG;
+		cli();
+		debug_drain();
+		SREG = intr_state;
+		if (debug_tail == debug_head) return;
+		// give up if nothing's moved for a few frames
+		if (debug_tail != tail) {
+			tail = debug_tail;
+			timeout = UDFNUML + 4;
+		} else if (UDFNUML == timeout) {
+			return;
+		}
+	}
 }
 
 
@@ -331,12 +623,38 @@ void usb_debug_flush_output(void)
 
 
 
+// move buffered debug output into the endpoint, as far as there's
+// room, sending each packet as it fills.  Once it's all moved, a
+// partly filled packet is padded out and sent.  Call with interrupts
+// disabled.
+static void debug_drain(void)
+{
+	uint8_t tail = debug_tail;
+
+	UENUM = DEBUG_TX_ENDPOINT;
+	while (UEINTX & (1<<RWAL)) {
+		if (tail == debug_head) {
+			if (UEBCLX) {
+				while (UEINTX & (1<<RWAL)) {
+					UEDATX = 0;
+				}
+				UEINTX = 0x3A;
+			}
+			break;
+		}
+		UEDATX = debug_ring[tail];
+		tail = (tail + 1) & (DEBUG_RING_SIZE - 1);
+		if (!(UEINTX & (1<<RWAL))) UEINTX = 0x3A;
+	}
+	debug_tail = tail;
+}
+
 // USB Device Interrupt - handle all device-level events
-// the transmit buffer flushing is triggered by the start of frame
+// buffered debug output is sent at each start of frame
 //
 ISR(USB_GEN_vect)
 {
-	uint8_t intbits, t;
+	uint8_t intbits;
 
         intbits = UDINT;
         UDINT = 0;
@@ -350,17 +668,7 @@ ISR(USB_GEN_vect)
         }
 	if (intbits & (1<<SOFI)) {
 		if (usb_configuration) {
-			t = debug_flush_timer;
-			if (t) {
-				debug_flush_timer = -- t;
-				if (!t) {
-					UENUM = DEBUG_TX_ENDPOINT;
-					while ((UEINTX & (1<<RWAL))) {
-						UEDATX = 0;
-					}
-					UEINTX = 0x3A;
-				}
-			}
+			debug_drain();
 		}
 	}
 }
@@ -469,7 +777,7 @@ ISR(USB_COM_vect)
 			usb_configuration = wValue;
 			usb_send_in();
 			cfg = endpoint_config_table;
-			for (i=1; i<5; i++) {
+			for (i=1; i<=MAX_ENDPOINT; i++) {
 				UENUM = i;
 				en = pgm_read_byte(cfg++);
 				UECONX = en;
@@ -478,7 +786,7 @@ ISR(USB_COM_vect)
 					UECFG1X = pgm_read_byte(cfg++);
 				}
 			}
-        		UERST = 0x1E;
+        		UERST = 0x3E;
         		UERST = 0;
 			return;
 		}
@@ -522,6 +830,31 @@ ISR(USB_COM_vect)
 			}
 		}
 		#endif
+		#ifdef PROFILE
+		// the profiler's histogram, as the debug interface's feature
+		// report. Timer3 can't interrupt this, so it's consistent.
+		if (bRequest == HID_GET_REPORT && bmRequestType == 0xA1
+		  && wIndex == 0 && (wValue >> 8) == 3) {
+			const uint8_t *p = (const uint8_t *)&profile;
+			uint16_t left = sizeof(profile);
+			if (left > wLength) left = wLength;
+			do {
+				// wait for host ready for IN packet
+				do {
+					i = UEINTX;
+				} while (!(i & ((1<<TXINI)|(1<<RXOUTI))));
+				if (i & (1<<RXOUTI)) return;	// abort
+				// send IN packet
+				n = left < ENDPOINT0_SIZE ? left : ENDPOINT0_SIZE;
+				for (i = n; i; i--) {
+					UEDATX = *p++;
+				}
+				left -= n;
+				usb_send_in();
+			} while (left || n == ENDPOINT0_SIZE);
+			return;
+		}
+		#endif
 		if (bRequest == HID_GET_REPORT && bmRequestType == 0xA1) {
 			if (wIndex == 0) {
 				len = wLength;
@@ -6,10 +6,23 @@
 void usb_init(void);			// initialize everything
 uint8_t usb_configured(void);		// is the USB port configured
 
-int8_t usb_debug_putchar(uint8_t c);	// transmit a character
-void usb_debug_flush_output(void);	// immediately transmit any buffered output
+int8_t usb_debug_putchar(uint8_t c);	// buffer a character to transmit, never waiting
+void usb_debug_flush_output(void);	// transmit all buffered output, waiting for room
+int8_t usb_debug_write(const uint8_t *buffer, uint8_t size); // buffer all of a record, or none
+uint8_t usb_debug_queued(void);	// bytes waiting to be sent
+uint16_t usb_debug_dropped(void);	// bytes dropped with the buffer full
 #define USB_DEBUG_HID
 
+#define RAWHID_SIZE 64
+int8_t usb_rawhid_recv(uint8_t *buffer);	// receive a report, if one is waiting
+int8_t usb_rawhid_send(const uint8_t *buffer, uint8_t timeout); // send a report
+
+// Only with BULK_LINK
+#define BULK_SIZE 64
+uint8_t usb_bulk_available(void);	// bytes waiting to be read
+int8_t usb_bulk_read(uint8_t *buffer, uint8_t size); // receive what's arrived
+int8_t usb_bulk_send(const uint8_t *buffer, uint8_t size, uint8_t timeout); // send a packet
+
 
 // Everything below this point is only intended for usb_serial.c
 #ifdef USB_SERIAL_PRIVATE_INCLUDE
@@ -33,7 +46,7 @@ void usb_debug_flush_output(void);	// immediately transmit any buffered output
 			((s) == 16 ? 0x10 :	\
 			             0x00)))
 
-#define MAX_ENDPOINT		4
+#define MAX_ENDPOINT		5
 
 #define LSB(n) (n & 255)
 #define MSB(n) ((n >> 8) & 255)